@@ -0,0 +1,794 @@
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <random>
+#include <d3d11.h>
+#include <Windows.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include "ColorMatch.h"
+#include "FrameRecording.h"
+#include "GpuColorMatcher.h"
+
+#pragma comment(lib, "d3d11.lib")
+
+// Replays BGRA frames through every match kernel and reports how long each one takes and what
+// it found. The scalar kernel is the reference; any other kernel that finds a different pixel
+// in some frame is reported as a mismatch and makes the run fail.
+
+// One BGRA8 frame, rows packed without padding
+struct BenchmarkFrame {
+    int width;
+    int height;
+    std::vector<BYTE> pixels;
+};
+
+// Frames that are replayed and reported together
+struct BenchmarkSet {
+    std::string name;
+    std::vector<BenchmarkFrame> frames;
+};
+
+struct BenchmarkOptions {
+    std::vector<COLORREF> targetColors;
+    int tolerance;
+    MatchMetric metric;
+    int hueTolerance;   // Degrees, hsv only
+    bool findClosest;
+    int width;
+    int height;
+    int frameCount;     // Frames per synthetic pattern
+    int iterations;     // Timed runs of every kernel over every frame
+    int scanThreads;    // Threads of the tiled scan, 0 = one per core
+    int trackingWindow; // Window of the tracked scan, 0 = no tracked scan
+    int minBlobArea;    // Smallest blob of the blob scan, 0 = no blob scan
+    int coarseTileSize; // Tiles of the coarse GPU pass, 0 = no coarse pass
+    bool useGpu;
+    bool scRgb;         // Upload the GPU matcher's frames as half floats, like an HDR desktop
+    bool printCoordinates;
+    std::vector<std::string> bitmapPaths;
+    std::vector<std::string> recordingPaths;
+
+    BenchmarkOptions();
+};
+
+BenchmarkOptions::BenchmarkOptions() :
+    targetColors({ RGB(234, 35, 1), RGB(218, 9, 1), RGB(227, 69, 53), RGB(227, 69, 53) }),
+    tolerance(15), metric(MatchMetric::Redmean), hueTolerance(10), findClosest(true), width(256), height(256), frameCount(32), iterations(8),
+    scanThreads(0), trackingWindow(24), minBlobArea(1), coarseTileSize(16), useGpu(true), scRgb(false), printCoordinates(false) {
+}
+
+struct MatchLocation {
+    int x;
+    int y;
+};
+
+inline bool operator!=(const MatchLocation& a, const MatchLocation& b) {
+    return a.x != b.x || a.y != b.y;
+}
+
+// Timings and results of one kernel over one BenchmarkSet
+struct KernelRun {
+    std::string name;
+    std::vector<double> samples;           // Nanoseconds per frame, every iteration
+    std::vector<MatchLocation> locations;  // Result per frame
+    double totalNs;
+    long long totalPixels;
+    // Tracked scans may lock on to a different target than the reference when there are
+    // several, and blob scans report centroids, so their mismatches are shown but don't fail
+    // the run
+    bool exact;
+};
+
+static double GetTicksPerNs() {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    return static_cast<double>(frequency.QuadPart) / 1e9;
+}
+
+static LONGLONG Now() {
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart;
+}
+
+// Synthetic patterns on a background of random colors that match none of the targets:
+//   noise  - nothing planted, every kernel has to test every pixel
+//   sparse - a few target pixels anywhere in the frame
+//   edge   - a single target pixel on the border, the worst case for the closest match
+//   center - a target pixel at the center, the best case for the closest match
+//   solid  - every pixel is a target color
+//   moving - one target pixel moving 3 right and 2 down per frame, wrapping at the edges
+static BenchmarkSet MakePattern(const std::string& name, const BenchmarkOptions& options, const MatchTable& table,
+    unsigned int seed) {
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<int> byteValue(0, 255);
+    std::uniform_int_distribution<int> column(0, options.width - 1);
+    std::uniform_int_distribution<int> row(0, options.height - 1);
+    std::uniform_int_distribution<size_t> color(0, options.targetColors.size() - 1);
+
+    BenchmarkSet set;
+    set.name = name;
+
+    for (int i = 0; i < options.frameCount; ++i) {
+        BenchmarkFrame frame;
+        frame.width = options.width;
+        frame.height = options.height;
+        frame.pixels.resize(static_cast<size_t>(frame.width) * frame.height * 4);
+
+        auto plant = [&](int x, int y) {
+            COLORREF target = options.targetColors[color(random)];
+            BYTE* pixel = &frame.pixels[(static_cast<size_t>(y) * frame.width + x) * 4];
+            pixel[0] = GetBValue(target);
+            pixel[1] = GetGValue(target);
+            pixel[2] = GetRValue(target);
+            pixel[3] = 255;
+        };
+
+        for (size_t p = 0; p < frame.pixels.size(); p += 4) {
+            // Gives up after a few tries when the tolerance lets almost every color match
+            int r, g, b;
+            int attempts = 0;
+            do {
+                r = byteValue(random);
+                g = byteValue(random);
+                b = byteValue(random);
+            } while (MatchesTable(table, r, g, b) && ++attempts < 64);
+            frame.pixels[p + 0] = static_cast<BYTE>(b);
+            frame.pixels[p + 1] = static_cast<BYTE>(g);
+            frame.pixels[p + 2] = static_cast<BYTE>(r);
+            frame.pixels[p + 3] = 255;
+        }
+
+        if (name == "sparse") {
+            for (int k = 0; k < 4; ++k) {
+                plant(column(random), row(random));
+            }
+        }
+        else if (name == "edge") {
+            switch (random() % 4) {
+            case 0: plant(column(random), 0); break;
+            case 1: plant(column(random), frame.height - 1); break;
+            case 2: plant(0, row(random)); break;
+            default: plant(frame.width - 1, row(random)); break;
+            }
+        }
+        else if (name == "center") {
+            plant(frame.width / 2, frame.height / 2);
+        }
+        else if (name == "moving") {
+            plant((frame.width / 4 + i * 3) % frame.width, (frame.height / 4 + i * 2) % frame.height);
+        }
+        else if (name == "solid") {
+            for (int y = 0; y < frame.height; ++y) {
+                for (int x = 0; x < frame.width; ++x) {
+                    plant(x, y);
+                }
+            }
+        }
+
+        set.frames.push_back(std::move(frame));
+    }
+
+    return set;
+}
+
+// Loads an uncompressed 24 or 32-bit BMP, such as a saved screenshot, as one BGRA8 frame
+static bool LoadBitmapFrame(const std::string& path, BenchmarkFrame& frame) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+
+    BITMAPFILEHEADER fileHeader;
+    BITMAPINFOHEADER infoHeader;
+    file.read(reinterpret_cast<char*>(&fileHeader), sizeof(fileHeader));
+    file.read(reinterpret_cast<char*>(&infoHeader), sizeof(infoHeader));
+    if (!file || fileHeader.bfType != 0x4D42 || infoHeader.biWidth <= 0 || infoHeader.biHeight == 0 ||
+        (infoHeader.biBitCount != 24 && infoHeader.biBitCount != 32) ||
+        (infoHeader.biCompression != BI_RGB && infoHeader.biCompression != BI_BITFIELDS)) {
+        std::cerr << path << " is not an uncompressed 24 or 32-bit bitmap" << std::endl;
+        return false;
+    }
+
+    // Rows are stored bottom-up unless the height is negative, each padded to 4 bytes
+    bool bottomUp = infoHeader.biHeight > 0;
+    int bytesPerPixel = infoHeader.biBitCount / 8;
+    frame.width = infoHeader.biWidth;
+    frame.height = bottomUp ? infoHeader.biHeight : -infoHeader.biHeight;
+    size_t filePitch = (static_cast<size_t>(frame.width) * bytesPerPixel + 3) & ~static_cast<size_t>(3);
+
+    std::vector<BYTE> row(filePitch);
+    frame.pixels.resize(static_cast<size_t>(frame.width) * frame.height * 4);
+    file.seekg(fileHeader.bfOffBits);
+    for (int y = 0; y < frame.height; ++y) {
+        file.read(reinterpret_cast<char*>(row.data()), filePitch);
+        if (!file) {
+            std::cerr << path << " is truncated" << std::endl;
+            return false;
+        }
+        BYTE* destination = &frame.pixels[static_cast<size_t>(bottomUp ? frame.height - 1 - y : y) * frame.width * 4];
+        for (int x = 0; x < frame.width; ++x) {
+            destination[x * 4 + 0] = row[x * bytesPerPixel + 0];
+            destination[x * 4 + 1] = row[x * bytesPerPixel + 1];
+            destination[x * 4 + 2] = row[x * bytesPerPixel + 2];
+            destination[x * 4 + 3] = 255;
+        }
+    }
+
+    return true;
+}
+
+// Decodes every region record of a capture recording (record_path) that can be decoded, one
+// set per region name and size. Deltas whose key record was overwritten in the ring can't be.
+static bool LoadRecording(const std::string& path, std::vector<BenchmarkSet>& sets) {
+    RecordingReader reader;
+    if (!reader.Open(path)) {
+        return false;
+    }
+
+    std::map<std::string, std::vector<UINT>> previous;  // Last decoded pixels per region name
+    std::map<std::string, size_t> setIndex;             // Set per region name and size
+    RecordHeader header;
+    const BYTE* payload = nullptr;
+    std::vector<UINT> pixels;
+    int decoded = 0;
+    int skipped = 0;
+    int recordedMatches = 0;
+    while (reader.Next(header, payload)) {
+        std::string region(header.region, strnlen(header.region, sizeof(header.region)));
+        size_t pixelCount = header.width > 0 && header.height > 0 ? static_cast<size_t>(header.width) * header.height : 0;
+        auto last = previous.find(region);
+        const UINT* reference = last != previous.end() && last->second.size() == pixelCount ? last->second.data() : nullptr;
+        if (!DecodeRecordPixels(header, payload, reference, pixels)) {
+            skipped++;
+            continue;
+        }
+        previous[region] = pixels;
+
+        std::string size = std::to_string(header.width) + "x" + std::to_string(header.height);
+        auto found = setIndex.find(region + "|" + size);
+        if (found == setIndex.end()) {
+            BenchmarkSet set;
+            set.name = path + (region.empty() ? std::string() : ":" + region) + " " + size;
+            found = setIndex.insert(std::make_pair(region + "|" + size, sets.size())).first;
+            sets.push_back(std::move(set));
+        }
+
+        BenchmarkFrame frame;
+        frame.width = header.width;
+        frame.height = header.height;
+        frame.pixels.resize(pixelCount * 4);
+        memcpy(frame.pixels.data(), pixels.data(), frame.pixels.size());
+        sets[found->second].frames.push_back(std::move(frame));
+        decoded++;
+        if (header.matchX != -1) {
+            recordedMatches++;
+        }
+    }
+
+    std::cout << path << ": " << decoded << " region frames (" << recordedMatches << " matched when recorded), " <<
+        skipped << " skipped" << std::endl;
+    return true;
+}
+
+static bool ParseColors(const std::string& value, std::vector<COLORREF>& colors) {
+    std::vector<COLORREF> parsed;
+    size_t start = 0;
+    while (start < value.size()) {
+        size_t end = value.find(';', start);
+        if (end == std::string::npos) {
+            end = value.size();
+        }
+        int r, g, b;
+        char extra;
+        std::string color = value.substr(start, end - start);
+        if (sscanf_s(color.c_str(), " %d , %d , %d %c", &r, &g, &b, &extra, 1) != 3 ||
+            r < 0 || r > 255 || g < 0 || g > 255 || b < 0 || b > 255) {
+            return false;
+        }
+        parsed.push_back(RGB(r, g, b));
+        start = end + 1;
+    }
+    if (parsed.empty()) {
+        return false;
+    }
+    colors = parsed;
+    return true;
+}
+
+// Times settings over every frame of set, iterations times, after one untimed pass
+static KernelRun RunCpuKernel(const std::string& name, const ScanSettings& settings, const BenchmarkSet& set,
+    int iterations, double ticksPerNs) {
+    KernelRun run;
+    run.name = name;
+    run.exact = settings.trackingWindow == 0 && settings.minBlobArea == 0;
+    run.totalNs = 0;
+    run.totalPixels = 0;
+    run.locations.resize(set.frames.size());
+
+    std::vector<BYTE> mask;
+    std::vector<MatchBlob> blobs;
+    TrackingState tracking;
+    for (int iteration = -1; iteration < iterations; ++iteration) {
+        for (size_t i = 0; i < set.frames.size(); ++i) {
+            const BenchmarkFrame& frame = set.frames[i];
+            MatchLocation location;
+            MatchBlob blob;
+
+            LONGLONG start = Now();
+            ScanRegion(settings, tracking, frame.pixels.data(), frame.width * 4, frame.width, frame.height,
+                mask, blobs, location.x, location.y, blob);
+            LONGLONG end = Now();
+
+            run.locations[i] = location;
+            if (iteration >= 0) {
+                double ns = (end - start) / ticksPerNs;
+                run.samples.push_back(ns);
+                run.totalNs += ns;
+                run.totalPixels += static_cast<long long>(frame.width) * frame.height;
+            }
+        }
+    }
+
+    return run;
+}
+
+// For each 8-bit sRGB value, the smallest half float GetHalfToSrgbTable maps to it. Frames made
+// of these sit right at the conversion's rounding edges, where a GPU conversion that isn't the
+// CPU's would disagree.
+static const std::vector<unsigned short>& GetSrgbToHalfTable() {
+    static const std::vector<unsigned short> table = [] {
+        std::vector<unsigned short> halves(256, 0);
+        std::vector<bool> found(256, false);
+        const BYTE* toSrgb = GetHalfToSrgbTable();
+        for (int half = 0; half <= 0x3C00; ++half) {  // 0 to 1.0
+            BYTE value = toSrgb[half];
+            if (!found[value]) {
+                found[value] = true;
+                halves[value] = static_cast<unsigned short>(half);
+            }
+        }
+        return halves;
+    }();
+    return table;
+}
+
+// Same as RunCpuKernel for GpuColorMatcher, timing the dispatch and the blocking readback the
+// capture waits for. With tileSize set it times the coarse pass instead: flagging tiles on the
+// GPU, the blocking Map of the flags and scanning the flagged tiles of the frame on the CPU (the
+// capture's copy of those tiles isn't included). The capture waits on that same Map while it
+// still holds the duplication frame, so the stall is part of the time rather than hidden.
+// Every frame is uploaded before timing starts, as scRGB half floats that convert back to the
+// same BGRA8 pixels when scRgb is set.
+static bool RunGpuKernel(ID3D11Device* device, ID3D11DeviceContext* context, GpuColorMatcher& matcher,
+    const ScanSettings& settings, int tileSize, bool scRgb, const BenchmarkSet& set, int iterations, double ticksPerNs,
+    KernelRun& run) {
+    HRESULT hr;
+
+    run.name = std::string(tileSize > 0 ? "coarse" : "gpu") + (scRgb ? "-hdr" : "");
+    run.exact = true;
+    run.totalNs = 0;
+    run.totalPixels = 0;
+    run.locations.resize(set.frames.size());
+    run.samples.clear();
+
+    std::vector<ID3D11Texture2D*> textures;
+    std::vector<unsigned short> halfPixels;
+    for (const auto& frame : set.frames) {
+        D3D11_TEXTURE2D_DESC desc = {};
+        desc.Width = frame.width;
+        desc.Height = frame.height;
+        desc.MipLevels = 1;
+        desc.ArraySize = 1;
+        desc.Format = scRgb ? DXGI_FORMAT_R16G16B16A16_FLOAT : DXGI_FORMAT_B8G8R8A8_UNORM;
+        desc.SampleDesc.Count = 1;
+        desc.Usage = D3D11_USAGE_DEFAULT;
+        desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+        D3D11_SUBRESOURCE_DATA data = {};
+        data.pSysMem = frame.pixels.data();
+        data.SysMemPitch = frame.width * 4;
+        if (scRgb) {
+            const std::vector<unsigned short>& toHalf = GetSrgbToHalfTable();
+            size_t pixelCount = static_cast<size_t>(frame.width) * frame.height;
+            halfPixels.resize(pixelCount * 4);
+            for (size_t i = 0; i < pixelCount; ++i) {
+                halfPixels[i * 4 + 0] = toHalf[frame.pixels[i * 4 + 2]];
+                halfPixels[i * 4 + 1] = toHalf[frame.pixels[i * 4 + 1]];
+                halfPixels[i * 4 + 2] = toHalf[frame.pixels[i * 4 + 0]];
+                halfPixels[i * 4 + 3] = 0x3C00;  // 1.0
+            }
+            data.pSysMem = halfPixels.data();
+            data.SysMemPitch = frame.width * 8;
+        }
+
+        ID3D11Texture2D* texture = nullptr;
+        hr = device->CreateTexture2D(&desc, &data, &texture);
+        if (FAILED(hr)) {
+            std::cerr << "Failed to create frame texture. HRESULT: 0x" << std::hex << hr << std::dec << std::endl;
+            break;
+        }
+        textures.push_back(texture);
+    }
+
+    std::vector<BYTE> mask;
+    std::vector<UINT> tileBits;
+    bool succeeded = textures.size() == set.frames.size();
+    for (int iteration = -1; succeeded && iteration < iterations; ++iteration) {
+        for (size_t i = 0; i < set.frames.size(); ++i) {
+            const BenchmarkFrame& frame = set.frames[i];
+            MatchLocation location;
+
+            LONGLONG start = Now();
+            if (tileSize > 0) {
+                int tileCount = ((frame.width + tileSize - 1) / tileSize) * ((frame.height + tileSize - 1) / tileSize);
+                hr = matcher.BeginTileScan(context);
+                if (SUCCEEDED(hr)) {
+                    hr = matcher.SubmitTileScan(context, textures[i], 0, 0, frame.width, frame.height, settings.table,
+                        tileSize, 0);
+                }
+                if (SUCCEEDED(hr)) {
+                    hr = matcher.ReadTileScan(context, tileCount, tileBits);
+                }
+                if (SUCCEEDED(hr)) {
+                    FindMatchInTiles(settings, frame.pixels.data(), frame.width * 4, frame.width, frame.height,
+                        tileSize, tileBits.data(), 0, mask, location.x, location.y);
+                }
+            }
+            else {
+                hr = matcher.Submit(context, textures[i], 0, 0, frame.width, frame.height, settings.table,
+                    settings.findClosest);
+                if (SUCCEEDED(hr)) {
+                    hr = matcher.ReadResult(context, location.x, location.y);
+                }
+            }
+            LONGLONG end = Now();
+
+            if (FAILED(hr)) {
+                std::cerr << "GPU match failed. HRESULT: 0x" << std::hex << hr << std::dec << std::endl;
+                succeeded = false;
+                break;
+            }
+
+            run.locations[i] = location;
+            if (iteration >= 0) {
+                double ns = (end - start) / ticksPerNs;
+                run.samples.push_back(ns);
+                run.totalNs += ns;
+                run.totalPixels += static_cast<long long>(frame.width) * frame.height;
+            }
+        }
+    }
+
+    for (auto texture : textures) {
+        texture->Release();
+    }
+    return succeeded;
+}
+
+static double Percentile(std::vector<double> samples, double fraction) {
+    if (samples.empty()) {
+        return 0;
+    }
+    size_t index = min(samples.size() - 1, static_cast<size_t>(samples.size() * fraction));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+// Prints one line per kernel and returns the number of frames where an exact kernel disagreed
+// with the first (reference) run
+static int ReportSet(const BenchmarkSet& set, const std::vector<KernelRun>& runs, bool printCoordinates) {
+    const KernelRun& reference = runs[0];
+    int totalMismatches = 0;
+
+    std::cout << std::endl << set.name << ": " << set.frames.size() << " frame(s)";
+    if (!set.frames.empty()) {
+        std::cout << ", " << set.frames[0].width << "x" << set.frames[0].height;
+    }
+    std::cout << std::endl;
+    std::cout << std::left << std::setw(10) << "kernel" << std::right
+        << std::setw(12) << "ns/pixel" << std::setw(12) << "p50 us" << std::setw(12) << "p99 us"
+        << std::setw(10) << "matched" << std::setw(12) << "mismatches" << "  first frame" << std::endl;
+
+    for (const auto& run : runs) {
+        int matched = 0;
+        int mismatches = 0;
+        for (size_t i = 0; i < run.locations.size(); ++i) {
+            if (run.locations[i].x != -1) {
+                matched++;
+            }
+            if (run.locations[i] != reference.locations[i]) {
+                mismatches++;
+            }
+        }
+        if (run.exact) {
+            totalMismatches += mismatches;
+        }
+
+        std::ostringstream first;
+        if (!run.locations.empty()) {
+            first << "(" << run.locations[0].x << ", " << run.locations[0].y << ")";
+        }
+
+        std::cout << std::left << std::setw(10) << run.name << std::right << std::fixed
+            << std::setw(12) << std::setprecision(3) << (run.totalPixels ? run.totalNs / run.totalPixels : 0.0)
+            << std::setw(12) << std::setprecision(2) << Percentile(run.samples, 0.5) / 1000
+            << std::setw(12) << std::setprecision(2) << Percentile(run.samples, 0.99) / 1000
+            << std::setw(10) << matched << std::setw(12) << mismatches << "  " << first.str() << std::endl;
+    }
+
+    if (printCoordinates) {
+        for (size_t i = 0; i < set.frames.size(); ++i) {
+            std::cout << "  frame " << i << ":";
+            for (const auto& run : runs) {
+                std::cout << " " << run.name << "=(" << run.locations[i].x << ", " << run.locations[i].y << ")";
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    return totalMismatches;
+}
+
+static void PrintUsage() {
+    std::cout << "Usage: Benchmark [options] [frame.bmp ...]" << std::endl
+        << "  Without bitmaps or recordings, replays synthetic patterns (noise, sparse, edge, center, solid, moving)." << std::endl
+        << "  --colors r,g,b;...   target colors (default: the capture's defaults)" << std::endl
+        << "  --tolerance N        match tolerance (15)" << std::endl
+        << "  --metric M           redmean, euclidean or hsv (redmean)" << std::endl
+        << "  --hue-tolerance N    hue tolerance of the hsv metric in degrees (10)" << std::endl
+        << "  --first              report the first match instead of the closest to the center" << std::endl
+        << "  --size WxH           synthetic frame size (256x256)" << std::endl
+        << "  --frames N           frames per synthetic pattern (32)" << std::endl
+        << "  --iterations N       timed passes over every frame (8)" << std::endl
+        << "  --threads N          threads of the tiled scan (0 = one per core)" << std::endl
+        << "  --track N            window of the tracked scan (24, 0 = skip it)" << std::endl
+        << "  --blobs N            smallest blob of the blob scan (1, 0 = skip it)" << std::endl
+        << "  --coarse N           tile size of the coarse GPU pass (16, 0 = skip it)" << std::endl
+        << "  --replay FILE        replay the frames of a capture recording (record_path), can be repeated" << std::endl
+        << "  --no-gpu             skip the GPU matcher" << std::endl
+        << "  --hdr                upload the GPU matcher's frames as scRGB half floats" << std::endl
+        << "  --coords             print every kernel's match for every frame" << std::endl;
+}
+
+static bool ParseOptions(int argc, char* argv[], BenchmarkOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--colors" && hasValue) {
+            if (!ParseColors(argv[++i], options.targetColors)) {
+                std::cerr << "Invalid colors: " << argv[i] << std::endl;
+                return false;
+            }
+        }
+        else if (arg == "--tolerance" && hasValue) {
+            options.tolerance = atoi(argv[++i]);
+        }
+        else if (arg == "--metric" && hasValue) {
+            std::string metric = argv[++i];
+            if (metric == "redmean") options.metric = MatchMetric::Redmean;
+            else if (metric == "euclidean") options.metric = MatchMetric::Euclidean;
+            else if (metric == "hsv") options.metric = MatchMetric::HsvRange;
+            else {
+                std::cerr << "Invalid metric: " << metric << std::endl;
+                return false;
+            }
+        }
+        else if (arg == "--hue-tolerance" && hasValue) {
+            options.hueTolerance = atoi(argv[++i]);
+            options.hueTolerance = max(0, min(180, options.hueTolerance));
+        }
+        else if (arg == "--first") {
+            options.findClosest = false;
+        }
+        else if (arg == "--size" && hasValue) {
+            if (sscanf_s(argv[++i], "%dx%d", &options.width, &options.height) != 2 ||
+                options.width <= 0 || options.height <= 0) {
+                std::cerr << "Invalid size: " << argv[i] << std::endl;
+                return false;
+            }
+        }
+        else if (arg == "--frames" && hasValue) {
+            options.frameCount = atoi(argv[++i]);
+            options.frameCount = max(1, options.frameCount);
+        }
+        else if (arg == "--iterations" && hasValue) {
+            options.iterations = atoi(argv[++i]);
+            options.iterations = max(1, options.iterations);
+        }
+        else if (arg == "--threads" && hasValue) {
+            options.scanThreads = atoi(argv[++i]);
+            options.scanThreads = max(0, options.scanThreads);
+        }
+        else if (arg == "--track" && hasValue) {
+            options.trackingWindow = atoi(argv[++i]);
+            options.trackingWindow = max(0, options.trackingWindow);
+        }
+        else if (arg == "--blobs" && hasValue) {
+            options.minBlobArea = atoi(argv[++i]);
+            options.minBlobArea = max(0, options.minBlobArea);
+        }
+        else if (arg == "--coarse" && hasValue) {
+            options.coarseTileSize = atoi(argv[++i]);
+            options.coarseTileSize = max(0, options.coarseTileSize);
+        }
+        else if (arg == "--replay" && hasValue) {
+            options.recordingPaths.push_back(argv[++i]);
+        }
+        else if (arg == "--no-gpu") {
+            options.useGpu = false;
+        }
+        else if (arg == "--hdr") {
+            options.scRgb = true;
+        }
+        else if (arg == "--coords") {
+            options.printCoordinates = true;
+        }
+        else if (arg.compare(0, 2, "--") == 0) {
+            PrintUsage();
+            return false;
+        }
+        else {
+            options.bitmapPaths.push_back(arg);
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    BenchmarkOptions options;
+    if (!ParseOptions(argc, argv, options)) {
+        return 1;
+    }
+
+    MatchTable table;
+    BuildMatchTable(options.targetColors, options.tolerance, options.metric, options.hueTolerance, table);
+    MatchTable lutTable = table;
+    BuildMatchLut(lutTable);
+
+    std::vector<BenchmarkSet> sets;
+    // Recorded frames of different sizes are reported separately
+    for (const auto& path : options.recordingPaths) {
+        if (!LoadRecording(path, sets)) {
+            return 1;
+        }
+    }
+    if (!options.bitmapPaths.empty()) {
+        for (const auto& path : options.bitmapPaths) {
+            BenchmarkFrame frame;
+            if (!LoadBitmapFrame(path, frame)) {
+                return 1;
+            }
+            BenchmarkSet set;
+            set.name = path;
+            set.frames.push_back(std::move(frame));
+            sets.push_back(std::move(set));
+        }
+    }
+    else if (options.recordingPaths.empty()) {
+        const char* patterns[] = { "noise", "sparse", "edge", "center", "solid", "moving" };
+        for (size_t i = 0; i < ARRAYSIZE(patterns); ++i) {
+            sets.push_back(MakePattern(patterns[i], options, table, static_cast<unsigned int>(i + 1)));
+        }
+    }
+
+    int threads = options.scanThreads;
+    if (threads == 0) {
+        threads = max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+
+    struct CpuVariant {
+        std::string name;
+        ScanSettings settings;
+    };
+    std::vector<CpuVariant> variants;
+
+    auto addVariant = [&](const std::string& name, const MatchTable& variantTable, MatchRowKernel kernel,
+        ScanOrder order, std::shared_ptr<ScanThreadPool> pool, int trackingWindow, int minBlobArea) {
+        CpuVariant variant;
+        variant.name = name;
+        variant.settings.table = variantTable;
+        variant.settings.kernel = kernel;
+        variant.settings.order = order;
+        variant.settings.findClosest = options.findClosest;
+        variant.settings.pool = pool;
+        variant.settings.trackingWindow = trackingWindow;
+        variant.settings.minBlobArea = minBlobArea;
+        variants.push_back(std::move(variant));
+    };
+
+    // The first variant is the reference the others are checked against
+    addVariant("scalar", table, MatchRowScalar, ScanOrder::RowMajor, nullptr, 0, 0);
+    if (CpuSupportsSse41()) {
+        addVariant("sse41", table, MatchRowSse41, ScanOrder::RowMajor, nullptr, 0, 0);
+    }
+    if (CpuSupportsAvx2()) {
+        addVariant("avx2", table, MatchRowAvx2, ScanOrder::RowMajor, nullptr, 0, 0);
+    }
+    // Widest kernel compiled for this metric and target count, what the capture uses
+    MatchRowKernel fixedKernel = SelectMatchRowKernel(table);
+    if (table.targets.size() >= 1 && table.targets.size() <= static_cast<size_t>(MAX_FIXED_TARGETS)) {
+        addVariant("fixed", table, fixedKernel, ScanOrder::RowMajor, nullptr, 0, 0);
+    }
+    addVariant("lut", lutTable, MatchRowLut, ScanOrder::RowMajor, nullptr, 0, 0);
+    if (options.findClosest) {
+        addVariant("spiral", table, fixedKernel, ScanOrder::Spiral, nullptr, 0, 0);
+    }
+    if (threads > 1) {
+        addVariant("tiled", table, fixedKernel, ScanOrder::RowMajor, GetSharedScanPool(threads), 0, 0);
+    }
+    // Only agrees with the reference where the tracked target is the only one, as in "moving"
+    if (options.trackingWindow > 0) {
+        addVariant("tracked", table, fixedKernel, ScanOrder::RowMajor, nullptr, options.trackingWindow, 0);
+    }
+    if (options.minBlobArea > 0) {
+        addVariant("blobs", table, fixedKernel, ScanOrder::RowMajor, nullptr, 0, options.minBlobArea);
+    }
+
+    // Coarse passes scan the flagged tiles with the widest kernel
+    ScanSettings coarseSettings = variants[0].settings;
+    coarseSettings.kernel = fixedKernel;
+
+    ID3D11Device* device = nullptr;
+    ID3D11DeviceContext* context = nullptr;
+    GpuColorMatcher gpuMatcher;
+    if (options.useGpu) {
+        HRESULT hr = D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_HARDWARE, nullptr, D3D11_CREATE_DEVICE_BGRA_SUPPORT,
+            nullptr, 0, D3D11_SDK_VERSION, &device, nullptr, &context);
+        if (FAILED(hr)) {
+            std::cerr << "Failed to create D3D11 device, skipping the GPU matcher. HRESULT: 0x"
+                << std::hex << hr << std::dec << std::endl;
+        }
+        else if (FAILED(gpuMatcher.Initialize(device))) {
+            std::cerr << "Skipping the GPU matcher." << std::endl;
+        }
+    }
+
+    static const char* const METRIC_NAMES[] = { "redmean", "euclidean", "hsv" };
+    std::cout << table.targets.size() << " target color(s), " << METRIC_NAMES[static_cast<int>(options.metric)] <<
+        " tolerance " << options.tolerance << ", "
+        << (options.findClosest ? "closest match" : "first match") << ", " << options.iterations
+        << " iteration(s), " << threads << " tiled scan thread(s)" << std::endl;
+
+    double ticksPerNs = GetTicksPerNs();
+    int mismatches = 0;
+    for (const auto& set : sets) {
+        std::vector<KernelRun> runs;
+        for (const auto& variant : variants) {
+            runs.push_back(RunCpuKernel(variant.name, variant.settings, set, options.iterations, ticksPerNs));
+        }
+        if (gpuMatcher.IsInitialized()) {
+            KernelRun gpuRun;
+            if (RunGpuKernel(device, context, gpuMatcher, variants[0].settings, 0, options.scRgb, set, options.iterations,
+                ticksPerNs, gpuRun)) {
+                runs.push_back(std::move(gpuRun));
+            }
+            KernelRun coarseRun;
+            if (options.coarseTileSize > 0 && RunGpuKernel(device, context, gpuMatcher, coarseSettings,
+                options.coarseTileSize, options.scRgb, set, options.iterations, ticksPerNs, coarseRun)) {
+                runs.push_back(std::move(coarseRun));
+            }
+        }
+        mismatches += ReportSet(set, runs, options.printCoordinates);
+    }
+
+    gpuMatcher.CleanUp();
+    if (context) context->Release();
+    if (device) device->Release();
+
+    if (mismatches > 0) {
+        std::cout << std::endl << mismatches << " mismatch(es) against the scalar kernel" << std::endl;
+        return 2;
+    }
+    return 0;
+}
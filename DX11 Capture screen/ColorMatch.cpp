@@ -0,0 +1,1059 @@
+#include "ColorMatch.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <intrin.h>
+#include <immintrin.h>
+
+void BuildMatchTable(const std::vector<COLORREF>& colors, int tolerance, MatchMetric metric, int hueTolerance,
+    MatchTable& table) {
+    table.targets.clear();
+    table.lut.clear();
+    table.metric = metric;
+
+    // Any tolerance above ~810 already matches every color; clamp so the thresholds fit in 32 bits
+    int clampedTolerance = min(tolerance, 1000);
+    int hueRange = min(HSV_HUE_CIRCLE / 2, max(0, (hueTolerance * HSV_HUE_CIRCLE + 180) / 360));
+    for (size_t i = 0; i < colors.size(); ++i) {
+        // Repeated colors cannot change the result, only cost another test per pixel
+        if (std::find(colors.begin(), colors.begin() + i, colors[i]) != colors.begin() + i) {
+            continue;
+        }
+        MatchTarget target = {};
+        target.r = GetRValue(colors[i]);
+        target.g = GetGValue(colors[i]);
+        target.b = GetBValue(colors[i]);
+
+        HsvTerms hsv(target.r, target.g, target.b);
+        target.value = hsv.value;
+        target.saturation = hsv.value > 0 ? (255 * hsv.chroma + hsv.value / 2) / hsv.value : 0;
+        target.hue = hsv.chroma > 0 ? static_cast<int>(std::lround(static_cast<double>(hsv.hueNumerator) / hsv.chroma)) : 0;
+        target.hueRange = hsv.chroma > 0 ? hueRange : HSV_HUE_CIRCLE / 2;
+        table.targets.push_back(target);
+    }
+
+    if (tolerance < 0) {
+        table.threshold = -1;
+    }
+    else if (metric == MatchMetric::Redmean) {
+        table.threshold = 512 * clampedTolerance * clampedTolerance;
+    }
+    else if (metric == MatchMetric::Euclidean) {
+        table.threshold = clampedTolerance * clampedTolerance;
+    }
+    else {
+        table.threshold = clampedTolerance;
+    }
+}
+
+// Fills table.lut with the match result of every 24-bit color, evaluating only the part of the
+// cube around each target that can match:
+//   Redmean: every weight in ScaledColorDistance is at least 1024 for red and blue and 2048 for
+//     green, so |dr|, |db| <= sqrt(threshold / 1024), |dg| <= sqrt(threshold / 2048).
+//   Euclidean: every channel within the tolerance.
+//   HsvRange: value is the largest channel, so no channel above value + tolerance.
+void BuildMatchLut(MatchTable& table) {
+    table.lut.assign((1 << 24) / 32, 0);
+    if (table.threshold < 0) {
+        return;
+    }
+
+    for (const auto& target : table.targets) {
+        int rLow, rHigh, gLow, gHigh, bLow, bHigh;
+        if (table.metric == MatchMetric::HsvRange) {
+            int high = min(255, target.value + table.threshold);
+            rLow = gLow = bLow = 0;
+            rHigh = gHigh = bHigh = high;
+        }
+        else {
+            int rbRange = table.metric == MatchMetric::Redmean ? static_cast<int>(std::sqrt(table.threshold / 1024.0)) :
+                static_cast<int>(std::sqrt(static_cast<double>(table.threshold)));
+            int gRange = table.metric == MatchMetric::Redmean ? static_cast<int>(std::sqrt(table.threshold / 2048.0)) : rbRange;
+            rLow = max(0, target.r - rbRange);
+            rHigh = min(255, target.r + rbRange);
+            gLow = max(0, target.g - gRange);
+            gHigh = min(255, target.g + gRange);
+            bLow = max(0, target.b - rbRange);
+            bHigh = min(255, target.b + rbRange);
+        }
+
+        for (int r = rLow; r <= rHigh; ++r) {
+            for (int g = gLow; g <= gHigh; ++g) {
+                for (int b = bLow; b <= bHigh; ++b) {
+                    bool matched;
+                    switch (table.metric) {
+                    case MatchMetric::Euclidean: matched = MatchesTarget<MatchMetric::Euclidean>(table, target, r, g, b); break;
+                    case MatchMetric::HsvRange: matched = MatchesTarget<MatchMetric::HsvRange>(table, target, r, g, b); break;
+                    default: matched = MatchesTarget<MatchMetric::Redmean>(table, target, r, g, b); break;
+                    }
+                    if (matched) {
+                        UINT index = (r << 16) | (g << 8) | b;
+                        table.lut[index >> 5] |= 1u << (index & 31);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// The corners of the RGB cube are as far from the targets as colors get
+bool FindUnmatchedPixel(const MatchTable& table, UINT& pixel) {
+    for (int corner = 0; corner < 8; ++corner) {
+        UINT candidate = 0xFF000000 | ((corner & 4) ? 0xFF0000 : 0) | ((corner & 2) ? 0xFF00 : 0) | ((corner & 1) ? 0xFF : 0);
+        if (!MatchesPixel(table, reinterpret_cast<const BYTE*>(&candidate))) {
+            pixel = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Row matchers are templates over the metric and the number of targets (0 = however many the
+// table has). The generic kernels pick the metric once per row; SelectMatchRowKernel hands out
+// instantiations with a fixed count, whose per-target loops the compiler unrolls.
+template <MatchMetric Metric, int Targets>
+static void MatchRowScalarFixed(const BYTE* row, int width, const MatchTable& table, BYTE* mask) {
+    for (int x = 0; x < width; ++x) {
+        const BYTE* pixel = row + x * 4;  // 4 bytes per pixel (BGRA)
+        mask[x] = MatchesTargets<Metric, Targets>(table, pixel[2], pixel[1], pixel[0]) ? 1 : 0;
+    }
+}
+
+void MatchRowScalar(const BYTE* row, int width, const MatchTable& table, BYTE* mask) {
+    switch (table.metric) {
+    case MatchMetric::Euclidean: MatchRowScalarFixed<MatchMetric::Euclidean, 0>(row, width, table, mask); break;
+    case MatchMetric::HsvRange: MatchRowScalarFixed<MatchMetric::HsvRange, 0>(row, width, table, mask); break;
+    default: MatchRowScalarFixed<MatchMetric::Redmean, 0>(row, width, table, mask); break;
+    }
+}
+
+// One table lookup per pixel regardless of the number of targets; requires BuildMatchLut
+void MatchRowLut(const BYTE* row, int width, const MatchTable& table, BYTE* mask) {
+    const UINT* lut = table.lut.data();
+    for (int x = 0; x < width; ++x) {
+        UINT pixel;
+        memcpy(&pixel, row + x * 4, sizeof(pixel));
+        UINT index = pixel & 0xFFFFFF;
+        mask[x] = static_cast<BYTE>((lut[index >> 5] >> (index & 31)) & 1);
+    }
+}
+
+// 4 BGRA pixels split into channels, with the HSV terms when the metric needs them
+struct PixelsSse41 {
+    __m128i r;
+    __m128i g;
+    __m128i b;
+    __m128i value;
+    __m128i chroma;
+    __m128i hueNumerator;
+    __m128i saturation255;
+};
+
+template <MatchMetric Metric>
+static inline PixelsSse41 SplitPixelsSse41(__m128i pixels) {
+    const __m128i byteMask = _mm_set1_epi32(0xFF);
+    PixelsSse41 split;
+    split.b = _mm_and_si128(pixels, byteMask);
+    split.g = _mm_and_si128(_mm_srli_epi32(pixels, 8), byteMask);
+    split.r = _mm_and_si128(_mm_srli_epi32(pixels, 16), byteMask);
+    if (Metric == MatchMetric::HsvRange) {
+        // Same terms as HsvTerms, with the branches as blends
+        split.value = _mm_max_epi32(split.r, _mm_max_epi32(split.g, split.b));
+        split.chroma = _mm_sub_epi32(split.value, _mm_min_epi32(split.r, _mm_min_epi32(split.g, split.b)));
+        __m128i isR = _mm_cmpeq_epi32(split.value, split.r);
+        __m128i isG = _mm_andnot_si128(isR, _mm_cmpeq_epi32(split.value, split.g));
+        __m128i hueR = _mm_slli_epi32(_mm_sub_epi32(split.g, split.b), 8);
+        __m128i hueG = _mm_add_epi32(_mm_slli_epi32(_mm_sub_epi32(split.b, split.r), 8), _mm_slli_epi32(split.chroma, 9));
+        __m128i hueB = _mm_add_epi32(_mm_slli_epi32(_mm_sub_epi32(split.r, split.g), 8), _mm_slli_epi32(split.chroma, 10));
+        split.hueNumerator = _mm_blendv_epi8(_mm_blendv_epi8(hueB, hueG, isG), hueR, isR);
+        split.saturation255 = _mm_sub_epi32(_mm_slli_epi32(split.chroma, 8), split.chroma);
+    }
+    return split;
+}
+
+// All-ones lanes for the pixels that match target by the metric's rule
+template <MatchMetric Metric>
+static inline __m128i MatchTargetSse41(const PixelsSse41& pixels, const MatchTarget& target, int threshold) {
+    if (Metric == MatchMetric::HsvRange) {
+        __m128i valueLow = _mm_set1_epi32(target.value - threshold - 1);
+        __m128i valueHigh = _mm_set1_epi32(target.value + threshold + 1);
+        __m128i saturationLow = _mm_mullo_epi32(_mm_set1_epi32(target.saturation - threshold), pixels.value);
+        __m128i saturationHigh = _mm_mullo_epi32(_mm_set1_epi32(target.saturation + threshold), pixels.value);
+        __m128i hueDiff = _mm_abs_epi32(_mm_sub_epi32(pixels.hueNumerator, _mm_mullo_epi32(_mm_set1_epi32(target.hue), pixels.chroma)));
+        __m128i hueNear = _mm_mullo_epi32(_mm_set1_epi32(target.hueRange), pixels.chroma);
+        __m128i hueWrapped = _mm_mullo_epi32(_mm_set1_epi32(HSV_HUE_CIRCLE - target.hueRange), pixels.chroma);
+
+        __m128i matched = _mm_and_si128(_mm_cmpgt_epi32(pixels.value, valueLow), _mm_cmplt_epi32(pixels.value, valueHigh));
+        __m128i saturationOut = _mm_or_si128(_mm_cmplt_epi32(pixels.saturation255, saturationLow),
+            _mm_cmpgt_epi32(pixels.saturation255, saturationHigh));
+        matched = _mm_andnot_si128(saturationOut, matched);
+        // hueDiff <= hueNear or hueDiff >= hueWrapped
+        __m128i hueOut = _mm_and_si128(_mm_cmpgt_epi32(hueDiff, hueNear), _mm_cmplt_epi32(hueDiff, hueWrapped));
+        return _mm_andnot_si128(hueOut, matched);
+    }
+
+    __m128i dr = _mm_sub_epi32(pixels.r, _mm_set1_epi32(target.r));
+    __m128i dg = _mm_sub_epi32(pixels.g, _mm_set1_epi32(target.g));
+    __m128i db = _mm_sub_epi32(pixels.b, _mm_set1_epi32(target.b));
+    __m128i dist;
+    if (Metric == MatchMetric::Redmean) {
+        __m128i rsum = _mm_add_epi32(pixels.r, _mm_set1_epi32(target.r));
+        __m128i weightR = _mm_add_epi32(_mm_set1_epi32(1024), rsum);
+        __m128i weightB = _mm_sub_epi32(_mm_set1_epi32(1534), rsum);
+        dist = _mm_mullo_epi32(weightR, _mm_mullo_epi32(dr, dr));
+        dist = _mm_add_epi32(dist, _mm_slli_epi32(_mm_mullo_epi32(dg, dg), 11));
+        dist = _mm_add_epi32(dist, _mm_mullo_epi32(weightB, _mm_mullo_epi32(db, db)));
+    }
+    else {
+        dist = _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(dr, dr), _mm_mullo_epi32(dg, dg)), _mm_mullo_epi32(db, db));
+    }
+    return _mm_cmplt_epi32(dist, _mm_set1_epi32(threshold + 1));
+}
+
+// Returns an all-ones lane for every pixel in the 4 BGRA pixels that matches any target
+template <MatchMetric Metric, int Targets>
+static inline __m128i MatchPixelsSse41(__m128i pixels, const MatchTable& table) {
+    PixelsSse41 split = SplitPixelsSse41<Metric>(pixels);
+    int count = Targets > 0 ? Targets : static_cast<int>(table.targets.size());
+    __m128i matched = _mm_setzero_si128();
+    for (int i = 0; i < count; ++i) {
+        matched = _mm_or_si128(matched, MatchTargetSse41<Metric>(split, table.targets[i], table.threshold));
+    }
+    return matched;
+}
+
+template <MatchMetric Metric, int Targets>
+static void MatchRowSse41Fixed(const BYTE* row, int width, const MatchTable& table, BYTE* mask) {
+    const __m128i one = _mm_set1_epi8(1);
+    int x = 0;
+
+    // 8 pixels per iteration
+    for (; x + 8 <= width; x += 8) {
+        __m128i m0 = MatchPixelsSse41<Metric, Targets>(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x * 4)), table);
+        __m128i m1 = MatchPixelsSse41<Metric, Targets>(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x * 4 + 16)), table);
+        __m128i packed = _mm_packs_epi16(_mm_packs_epi32(m0, m1), _mm_setzero_si128());
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(mask + x), _mm_and_si128(packed, one));
+    }
+
+    MatchRowScalarFixed<Metric, Targets>(row + x * 4, width - x, table, mask + x);
+}
+
+void MatchRowSse41(const BYTE* row, int width, const MatchTable& table, BYTE* mask) {
+    switch (table.metric) {
+    case MatchMetric::Euclidean: MatchRowSse41Fixed<MatchMetric::Euclidean, 0>(row, width, table, mask); break;
+    case MatchMetric::HsvRange: MatchRowSse41Fixed<MatchMetric::HsvRange, 0>(row, width, table, mask); break;
+    default: MatchRowSse41Fixed<MatchMetric::Redmean, 0>(row, width, table, mask); break;
+    }
+}
+
+// Same as PixelsSse41 for 8 pixels
+struct PixelsAvx2 {
+    __m256i r;
+    __m256i g;
+    __m256i b;
+    __m256i value;
+    __m256i chroma;
+    __m256i hueNumerator;
+    __m256i saturation255;
+};
+
+template <MatchMetric Metric>
+static inline PixelsAvx2 SplitPixelsAvx2(__m256i pixels) {
+    const __m256i byteMask = _mm256_set1_epi32(0xFF);
+    PixelsAvx2 split;
+    split.b = _mm256_and_si256(pixels, byteMask);
+    split.g = _mm256_and_si256(_mm256_srli_epi32(pixels, 8), byteMask);
+    split.r = _mm256_and_si256(_mm256_srli_epi32(pixels, 16), byteMask);
+    if (Metric == MatchMetric::HsvRange) {
+        split.value = _mm256_max_epi32(split.r, _mm256_max_epi32(split.g, split.b));
+        split.chroma = _mm256_sub_epi32(split.value, _mm256_min_epi32(split.r, _mm256_min_epi32(split.g, split.b)));
+        __m256i isR = _mm256_cmpeq_epi32(split.value, split.r);
+        __m256i isG = _mm256_andnot_si256(isR, _mm256_cmpeq_epi32(split.value, split.g));
+        __m256i hueR = _mm256_slli_epi32(_mm256_sub_epi32(split.g, split.b), 8);
+        __m256i hueG = _mm256_add_epi32(_mm256_slli_epi32(_mm256_sub_epi32(split.b, split.r), 8), _mm256_slli_epi32(split.chroma, 9));
+        __m256i hueB = _mm256_add_epi32(_mm256_slli_epi32(_mm256_sub_epi32(split.r, split.g), 8), _mm256_slli_epi32(split.chroma, 10));
+        split.hueNumerator = _mm256_blendv_epi8(_mm256_blendv_epi8(hueB, hueG, isG), hueR, isR);
+        split.saturation255 = _mm256_sub_epi32(_mm256_slli_epi32(split.chroma, 8), split.chroma);
+    }
+    return split;
+}
+
+// Same as MatchTargetSse41 for 8 pixels
+template <MatchMetric Metric>
+static inline __m256i MatchTargetAvx2(const PixelsAvx2& pixels, const MatchTarget& target, int threshold) {
+    if (Metric == MatchMetric::HsvRange) {
+        __m256i valueLow = _mm256_set1_epi32(target.value - threshold - 1);
+        __m256i valueHigh = _mm256_set1_epi32(target.value + threshold + 1);
+        __m256i saturationLow = _mm256_mullo_epi32(_mm256_set1_epi32(target.saturation - threshold), pixels.value);
+        __m256i saturationHigh = _mm256_mullo_epi32(_mm256_set1_epi32(target.saturation + threshold), pixels.value);
+        __m256i hueDiff = _mm256_abs_epi32(_mm256_sub_epi32(pixels.hueNumerator,
+            _mm256_mullo_epi32(_mm256_set1_epi32(target.hue), pixels.chroma)));
+        __m256i hueNear = _mm256_mullo_epi32(_mm256_set1_epi32(target.hueRange), pixels.chroma);
+        __m256i hueWrapped = _mm256_mullo_epi32(_mm256_set1_epi32(HSV_HUE_CIRCLE - target.hueRange), pixels.chroma);
+
+        __m256i matched = _mm256_and_si256(_mm256_cmpgt_epi32(pixels.value, valueLow), _mm256_cmpgt_epi32(valueHigh, pixels.value));
+        __m256i saturationOut = _mm256_or_si256(_mm256_cmpgt_epi32(saturationLow, pixels.saturation255),
+            _mm256_cmpgt_epi32(pixels.saturation255, saturationHigh));
+        matched = _mm256_andnot_si256(saturationOut, matched);
+        __m256i hueOut = _mm256_and_si256(_mm256_cmpgt_epi32(hueDiff, hueNear), _mm256_cmpgt_epi32(hueWrapped, hueDiff));
+        return _mm256_andnot_si256(hueOut, matched);
+    }
+
+    __m256i dr = _mm256_sub_epi32(pixels.r, _mm256_set1_epi32(target.r));
+    __m256i dg = _mm256_sub_epi32(pixels.g, _mm256_set1_epi32(target.g));
+    __m256i db = _mm256_sub_epi32(pixels.b, _mm256_set1_epi32(target.b));
+    __m256i dist;
+    if (Metric == MatchMetric::Redmean) {
+        __m256i rsum = _mm256_add_epi32(pixels.r, _mm256_set1_epi32(target.r));
+        __m256i weightR = _mm256_add_epi32(_mm256_set1_epi32(1024), rsum);
+        __m256i weightB = _mm256_sub_epi32(_mm256_set1_epi32(1534), rsum);
+        dist = _mm256_mullo_epi32(weightR, _mm256_mullo_epi32(dr, dr));
+        dist = _mm256_add_epi32(dist, _mm256_slli_epi32(_mm256_mullo_epi32(dg, dg), 11));
+        dist = _mm256_add_epi32(dist, _mm256_mullo_epi32(weightB, _mm256_mullo_epi32(db, db)));
+    }
+    else {
+        dist = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(dr, dr), _mm256_mullo_epi32(dg, dg)),
+            _mm256_mullo_epi32(db, db));
+    }
+    return _mm256_cmpgt_epi32(_mm256_set1_epi32(threshold + 1), dist);
+}
+
+// Same as MatchPixelsSse41 for 8 pixels
+template <MatchMetric Metric, int Targets>
+static inline __m256i MatchPixelsAvx2(__m256i pixels, const MatchTable& table) {
+    PixelsAvx2 split = SplitPixelsAvx2<Metric>(pixels);
+    int count = Targets > 0 ? Targets : static_cast<int>(table.targets.size());
+    __m256i matched = _mm256_setzero_si256();
+    for (int i = 0; i < count; ++i) {
+        matched = _mm256_or_si256(matched, MatchTargetAvx2<Metric>(split, table.targets[i], table.threshold));
+    }
+    return matched;
+}
+
+template <MatchMetric Metric, int Targets>
+static void MatchRowAvx2Fixed(const BYTE* row, int width, const MatchTable& table, BYTE* mask) {
+    const __m128i one = _mm_set1_epi8(1);
+    int x = 0;
+
+    // 16 pixels per iteration
+    for (; x + 16 <= width; x += 16) {
+        __m256i m0 = MatchPixelsAvx2<Metric, Targets>(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x * 4)), table);
+        __m256i m1 = MatchPixelsAvx2<Metric, Targets>(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x * 4 + 32)), table);
+        // packs works per 128-bit lane, so restore pixel order before the final pack
+        __m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(m0, m1), 0xD8);
+        __m128i packed = _mm_packs_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(mask + x), _mm_and_si128(packed, one));
+    }
+
+    MatchRowSse41Fixed<Metric, Targets>(row + x * 4, width - x, table, mask + x);
+}
+
+void MatchRowAvx2(const BYTE* row, int width, const MatchTable& table, BYTE* mask) {
+    switch (table.metric) {
+    case MatchMetric::Euclidean: MatchRowAvx2Fixed<MatchMetric::Euclidean, 0>(row, width, table, mask); break;
+    case MatchMetric::HsvRange: MatchRowAvx2Fixed<MatchMetric::HsvRange, 0>(row, width, table, mask); break;
+    default: MatchRowAvx2Fixed<MatchMetric::Redmean, 0>(row, width, table, mask); break;
+    }
+}
+
+bool CpuSupportsSse41() {
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 19)) != 0;
+}
+
+// AVX2 also needs the OS to save the YMM registers
+bool CpuSupportsAvx2() {
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (maxLeaf < 7 || !osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+}
+
+// Instantiations with the metric and target count fixed, by instruction set (scalar, SSE4.1,
+// AVX2) and target count - 1
+template <MatchMetric Metric>
+static MatchRowKernel SelectFixedKernel(int level, size_t targets) {
+    static const MatchRowKernel kernels[3][MAX_FIXED_TARGETS] = {
+        { MatchRowScalarFixed<Metric, 1>, MatchRowScalarFixed<Metric, 2>, MatchRowScalarFixed<Metric, 3>, MatchRowScalarFixed<Metric, 4> },
+        { MatchRowSse41Fixed<Metric, 1>, MatchRowSse41Fixed<Metric, 2>, MatchRowSse41Fixed<Metric, 3>, MatchRowSse41Fixed<Metric, 4> },
+        { MatchRowAvx2Fixed<Metric, 1>, MatchRowAvx2Fixed<Metric, 2>, MatchRowAvx2Fixed<Metric, 3>, MatchRowAvx2Fixed<Metric, 4> },
+    };
+    return kernels[level][targets - 1];
+}
+
+MatchRowKernel SelectMatchRowKernel(const MatchTable& table) {
+    static const int level = CpuSupportsAvx2() ? 2 : (CpuSupportsSse41() ? 1 : 0);
+    size_t targets = table.targets.size();
+    if (targets >= 1 && targets <= MAX_FIXED_TARGETS) {
+        switch (table.metric) {
+        case MatchMetric::Euclidean: return SelectFixedKernel<MatchMetric::Euclidean>(level, targets);
+        case MatchMetric::HsvRange: return SelectFixedKernel<MatchMetric::HsvRange>(level, targets);
+        default: return SelectFixedKernel<MatchMetric::Redmean>(level, targets);
+        }
+    }
+    static const MatchRowKernel generic[3] = { MatchRowScalar, MatchRowSse41, MatchRowAvx2 };
+    return generic[level];
+}
+
+static float HalfToFloat(unsigned short half) {
+    int exponent = (half >> 10) & 0x1F;
+    int mantissa = half & 0x3FF;
+    float value;
+    if (exponent == 0) {
+        value = std::ldexp(static_cast<float>(mantissa), -24);
+    }
+    else if (exponent == 31) {
+        value = mantissa ? 0.0f : INFINITY;  // NaN counts as black
+    }
+    else {
+        value = std::ldexp(static_cast<float>(mantissa | 0x400), exponent - 25);
+    }
+    return (half & 0x8000) ? -value : value;
+}
+
+// Maps every half float to the 8-bit sRGB value DWM would produce for linear scRGB, where
+// 1.0 is SDR white. Values outside [0, 1] clip, like the BGRA8 duplication does.
+const BYTE* GetHalfToSrgbTable() {
+    static const std::vector<BYTE> table = [] {
+        std::vector<BYTE> values(65536);
+        for (int i = 0; i < 65536; ++i) {
+            float linear = HalfToFloat(static_cast<unsigned short>(i));
+            linear = linear > 0.0f ? min(linear, 1.0f) : 0.0f;
+            float encoded = linear <= 0.0031308f ? 12.92f * linear : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+            values[i] = static_cast<BYTE>(encoded * 255.0f + 0.5f);
+        }
+        return values;
+    }();
+    return table.data();
+}
+
+// Converts a row of pixels in one of DUPLICATION_FORMATS to the BGRA8 layout the matchers read
+void ConvertRowToBgra8(DXGI_FORMAT format, const BYTE* source, int width, BYTE* destination) {
+    if (format == DXGI_FORMAT_R16G16B16A16_FLOAT) {
+        const BYTE* toSrgb = GetHalfToSrgbTable();
+        for (int x = 0; x < width; ++x) {
+            unsigned short rgba[4];
+            memcpy(rgba, source + x * 8, sizeof(rgba));
+            destination[x * 4 + 0] = toSrgb[rgba[2]];
+            destination[x * 4 + 1] = toSrgb[rgba[1]];
+            destination[x * 4 + 2] = toSrgb[rgba[0]];
+            destination[x * 4 + 3] = 255;
+        }
+    }
+    else if (format == DXGI_FORMAT_R10G10B10A2_UNORM) {
+        for (int x = 0; x < width; ++x) {
+            UINT pixel;
+            memcpy(&pixel, source + x * 4, sizeof(pixel));
+            destination[x * 4 + 0] = static_cast<BYTE>((pixel >> 22) & 0xFF);
+            destination[x * 4 + 1] = static_cast<BYTE>((pixel >> 12) & 0xFF);
+            destination[x * 4 + 2] = static_cast<BYTE>((pixel >> 2) & 0xFF);
+            destination[x * 4 + 3] = 255;
+        }
+    }
+    else {
+        memcpy(destination, source, static_cast<size_t>(width) * 4);
+    }
+}
+
+// Scans rows [rowBegin, rowEnd) of a width x height BGRA image. With findClosest it keeps a
+// running minimum of the squared distance to the center of the whole image in bestDist (the
+// first pixel in row order wins ties, like the old min_element pass) and stops as soon as every
+// remaining row is farther away than the best match; otherwise it stops at the first match.
+// mask must hold width bytes.
+static bool FindMatchInRows(const BYTE* data, UINT pitch, int width, int height, int rowBegin, int rowEnd,
+    const MatchTable& table, MatchRowKernel kernel, bool findClosest, BYTE* mask, int& foundX, int& foundY,
+    int& bestDist) {
+    int centerX = width / 2;
+    int centerY = height / 2;
+
+    foundX = -1;
+    foundY = -1;
+
+    for (int y = rowBegin; y < rowEnd; ++y) {
+        int dy = y - centerY;
+        if (y > centerY && dy * dy > bestDist) {
+            break;
+        }
+
+        kernel(data + y * pitch, width, table, mask);
+
+        for (int x = 0; x < width; ++x) {
+            if (!mask[x]) {
+                continue;
+            }
+            if (!findClosest) {
+                foundX = x;
+                foundY = y;
+                return true;
+            }
+
+            int dx = x - centerX;
+            int dist = dx * dx + dy * dy;
+            if (dist < bestDist) {
+                bestDist = dist;
+                foundX = x;
+                foundY = y;
+            }
+        }
+    }
+
+    return foundX != -1;
+}
+
+bool FindMatchRowMajor(const BYTE* data, UINT pitch, int width, int height, const MatchTable& table,
+    MatchRowKernel kernel, bool findClosest, BYTE* mask, int& foundX, int& foundY) {
+    int bestDist = INT_MAX;
+    return FindMatchInRows(data, pitch, width, height, 0, height, table, kernel, findClosest, mask,
+        foundX, foundY, bestDist);
+}
+
+// Tests pixels in square rings of growing radius around the center and returns the same pixel
+// as FindMatchRowMajor with findClosest. Every pixel on ring k is at least k away from the
+// center, so the scan can stop at the first ring with k^2 greater than the best distance.
+bool FindMatchSpiral(const BYTE* data, UINT pitch, int width, int height, const MatchTable& table,
+    int& foundX, int& foundY) {
+    int centerX = width / 2;
+    int centerY = height / 2;
+    int bestDist = INT_MAX;
+    int maxRing = max(max(centerX, width - 1 - centerX), max(centerY, height - 1 - centerY));
+
+    foundX = -1;
+    foundY = -1;
+
+    auto test = [&](int x, int y) {
+        if (!MatchesPixel(table, data + y * pitch + x * 4)) {
+            return;
+        }
+        int dx = x - centerX;
+        int dy = y - centerY;
+        int dist = dx * dx + dy * dy;
+        // Ties go to the lowest row, then the lowest column, matching the row-major scan
+        if (dist < bestDist || (dist == bestDist && (y < foundY || (y == foundY && x < foundX)))) {
+            bestDist = dist;
+            foundX = x;
+            foundY = y;
+        }
+    };
+
+    for (int ring = 0; ring <= maxRing && ring * ring <= bestDist; ++ring) {
+        int left = max(0, centerX - ring);
+        int right = min(width - 1, centerX + ring);
+        int top = centerY - ring;
+        int bottom = centerY + ring;
+
+        if (top >= 0) {
+            for (int x = left; x <= right; ++x) test(x, top);
+        }
+        if (bottom < height && ring > 0) {
+            for (int x = left; x <= right; ++x) test(x, bottom);
+        }
+        for (int y = max(0, top + 1); y <= min(height - 1, bottom - 1); ++y) {
+            if (centerX - ring >= 0) test(centerX - ring, y);
+            if (centerX + ring < width && ring > 0) test(centerX + ring, y);
+        }
+    }
+
+    return foundX != -1;
+}
+
+ScanThreadPool::ScanThreadPool(int threadCount) :
+    generation(0), exiting(false), activeWorkers(0), task(nullptr), context(nullptr), count(0),
+    nextIndex(0), remaining(0) {
+    for (int i = 1; i < threadCount; ++i) {
+        workers.emplace_back(&ScanThreadPool::WorkerLoop, this);
+    }
+}
+
+ScanThreadPool::~ScanThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        exiting = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+int ScanThreadPool::GetThreadCount() const {
+    return static_cast<int>(workers.size()) + 1;
+}
+
+void ScanThreadPool::Run(Task newTask, void* newContext, int newCount) {
+    std::lock_guard<std::mutex> runLock(runMutex);
+    {
+        // A worker that woke up late for the previous Run may still be holding its task
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return activeWorkers == 0; });
+        task = newTask;
+        context = newContext;
+        count = newCount;
+        nextIndex = 0;
+        remaining = newCount;
+        ++generation;
+    }
+    wake.notify_all();
+
+    RunTasks(newTask, newContext, newCount);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return remaining == 0; });
+}
+
+void ScanThreadPool::RunTasks(Task currentTask, void* currentContext, int currentCount) {
+    for (int i = nextIndex++; i < currentCount; i = nextIndex++) {
+        currentTask(currentContext, i);
+        if (--remaining == 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            done.notify_all();
+        }
+    }
+}
+
+void ScanThreadPool::WorkerLoop() {
+    unsigned long long seen = 0;
+
+    for (;;) {
+        Task currentTask;
+        void* currentContext;
+        int currentCount;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return exiting || generation != seen; });
+            if (exiting) {
+                return;
+            }
+            seen = generation;
+            currentTask = task;
+            currentContext = context;
+            currentCount = count;
+            activeWorkers++;
+        }
+
+        RunTasks(currentTask, currentContext, currentCount);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--activeWorkers == 0) {
+            done.notify_all();
+        }
+    }
+}
+
+// Returns the pool every capture in the process shares for the given thread count, so capturing
+// several outputs doesn't start a full set of workers for each of them
+std::shared_ptr<ScanThreadPool> GetSharedScanPool(int threadCount) {
+    static std::mutex poolMutex;
+    static std::weak_ptr<ScanThreadPool> sharedPool;
+
+    std::lock_guard<std::mutex> lock(poolMutex);
+    std::shared_ptr<ScanThreadPool> pool = sharedPool.lock();
+    if (!pool || pool->GetThreadCount() != threadCount) {
+        pool = std::make_shared<ScanThreadPool>(threadCount);
+        sharedPool = pool;
+    }
+    return pool;
+}
+
+static const int MIN_SCAN_BAND_ROWS = 16;
+static const int MAX_SCAN_BANDS = 64;
+
+// State shared by the bands of one FindMatchTiled call
+struct TiledScan {
+    const ScanSettings* settings;
+    const BYTE* data;
+    UINT pitch;
+    int width;
+    int height;
+    int bandRows;
+    std::atomic<int> bestDist;        // Closest match found by any band so far
+    std::atomic<int> firstMatchBand;  // Lowest band with a match when not looking for the closest
+
+    struct BandResult {
+        int x;
+        int y;
+        int dist;
+    } results[MAX_SCAN_BANDS];
+};
+
+static void ScanBand(void* context, int band) {
+    TiledScan& scan = *static_cast<TiledScan*>(context);
+    TiledScan::BandResult& result = scan.results[band];
+    int rowBegin = band * scan.bandRows;
+    int rowEnd = min(scan.height, rowBegin + scan.bandRows);
+    int centerY = scan.height / 2;
+
+    result.x = -1;
+    result.y = -1;
+    result.dist = INT_MAX;
+
+    // Skip bands that can no longer beat what other bands already found. Only strictly worse
+    // bands are skipped, so ties still go to the lowest row.
+    if (!scan.settings->findClosest) {
+        if (scan.firstMatchBand.load(std::memory_order_relaxed) < band) {
+            return;
+        }
+    }
+    else {
+        int nearestDy = centerY < rowBegin ? rowBegin - centerY : (centerY >= rowEnd ? centerY - (rowEnd - 1) : 0);
+        if (nearestDy * nearestDy > scan.bestDist.load(std::memory_order_relaxed)) {
+            return;
+        }
+    }
+
+    thread_local std::vector<BYTE> mask;
+    if (mask.size() < static_cast<size_t>(scan.width)) {
+        mask.resize(scan.width);
+    }
+
+    int bestDist = INT_MAX;
+    if (!FindMatchInRows(scan.data, scan.pitch, scan.width, scan.height, rowBegin, rowEnd, scan.settings->table,
+        scan.settings->kernel, scan.settings->findClosest, mask.data(), result.x, result.y, bestDist)) {
+        return;
+    }
+    result.dist = bestDist;
+
+    if (scan.settings->findClosest) {
+        int current = scan.bestDist.load(std::memory_order_relaxed);
+        while (bestDist < current && !scan.bestDist.compare_exchange_weak(current, bestDist, std::memory_order_relaxed)) {
+        }
+    }
+    else {
+        int current = scan.firstMatchBand.load(std::memory_order_relaxed);
+        while (band < current && !scan.firstMatchBand.compare_exchange_weak(current, band, std::memory_order_relaxed)) {
+        }
+    }
+}
+
+// Splits a row-major scan into bands of rows run on the settings' pool, then reduces the per-band
+// candidates in row order. Returns the same pixel as FindMatchRowMajor.
+bool FindMatchTiled(const ScanSettings& settings, const BYTE* data, UINT pitch, int width, int height,
+    int& foundX, int& foundY) {
+    int bands = min(min(MAX_SCAN_BANDS, settings.pool->GetThreadCount() * 2), height / MIN_SCAN_BAND_ROWS);
+
+    TiledScan scan;
+    scan.settings = &settings;
+    scan.data = data;
+    scan.pitch = pitch;
+    scan.width = width;
+    scan.height = height;
+    scan.bandRows = (height + bands - 1) / bands;
+    scan.bestDist = INT_MAX;
+    scan.firstMatchBand = INT_MAX;
+    bands = (height + scan.bandRows - 1) / scan.bandRows;
+
+    settings.pool->Run(ScanBand, &scan, bands);
+
+    foundX = -1;
+    foundY = -1;
+    int bestDist = INT_MAX;
+    for (int band = 0; band < bands; ++band) {
+        const TiledScan::BandResult& result = scan.results[band];
+        if (result.x == -1) {
+            continue;
+        }
+        if (!settings.findClosest) {
+            foundX = result.x;
+            foundY = result.y;
+            return true;
+        }
+        if (result.dist < bestDist) {
+            bestDist = result.dist;
+            foundX = result.x;
+            foundY = result.y;
+        }
+    }
+
+    return foundX != -1;
+}
+
+// Runs the configured scan over a width x height BGRA image. mask is scratch space owned by
+// the calling thread; tiled scans use per-thread masks of their own.
+bool ScanPixels(const ScanSettings& settings, const BYTE* data, UINT pitch, int width, int height,
+    std::vector<BYTE>& mask, int& foundX, int& foundY) {
+    if (settings.findClosest && settings.order == ScanOrder::Spiral) {
+        return FindMatchSpiral(data, pitch, width, height, settings.table, foundX, foundY);
+    }
+    if (settings.pool && height >= 2 * MIN_SCAN_BAND_ROWS) {
+        return FindMatchTiled(settings, data, pitch, width, height, foundX, foundY);
+    }
+
+    if (mask.size() < static_cast<size_t>(width)) {
+        mask.resize(width);
+    }
+    return FindMatchRowMajor(data, pitch, width, height, settings.table, settings.kernel,
+        settings.findClosest, mask.data(), foundX, foundY);
+}
+
+TrackingState::TrackingState() : hasMatch(false), lastX(0), lastY(0), motionX(0), motionY(0) {
+}
+
+// The window is shifted to stay inside the image, and within it the usual rules apply: the
+// match closest to the window's center, or the first one in row order.
+bool ScanPixelsTracked(const ScanSettings& settings, TrackingState& state, const BYTE* data, UINT pitch,
+    int width, int height, std::vector<BYTE>& mask, int& foundX, int& foundY) {
+    int side = settings.trackingWindow;
+    if (side > 0 && state.hasMatch && (side < width || side < height)) {
+        int windowWidth = min(side, width);
+        int windowHeight = min(side, height);
+        int predictedX = state.lastX + state.motionX;
+        int predictedY = state.lastY + state.motionY;
+        int left = max(0, min(width - windowWidth, predictedX - windowWidth / 2));
+        int top = max(0, min(height - windowHeight, predictedY - windowHeight / 2));
+
+        int windowX, windowY;
+        if (ScanPixels(settings, data + top * pitch + left * 4, pitch, windowWidth, windowHeight, mask,
+            windowX, windowY)) {
+            foundX = left + windowX;
+            foundY = top + windowY;
+            state.motionX = foundX - state.lastX;
+            state.motionY = foundY - state.lastY;
+            state.lastX = foundX;
+            state.lastY = foundY;
+            return true;
+        }
+    }
+
+    // A match found by the full scan may well be a different target, so it starts without motion
+    state.hasMatch = ScanPixels(settings, data, pitch, width, height, mask, foundX, foundY);
+    state.lastX = foundX;
+    state.lastY = foundY;
+    state.motionX = 0;
+    state.motionY = 0;
+    return state.hasMatch;
+}
+
+// A run of matching pixels [x0, x1) in row y, and its parent in the union-find forest
+struct MatchRun {
+    int x0;
+    int x1;
+    int y;
+    int parent;
+};
+
+static int FindRunRoot(std::vector<MatchRun>& runs, int run) {
+    while (runs[run].parent != run) {
+        runs[run].parent = runs[runs[run].parent].parent;  // Path halving
+        run = runs[run].parent;
+    }
+    return run;
+}
+
+// The lower index becomes the root, so a blob's root is always its first run in row order
+static void UniteRuns(std::vector<MatchRun>& runs, int a, int b) {
+    a = FindRunRoot(runs, a);
+    b = FindRunRoot(runs, b);
+    if (a < b) {
+        runs[b].parent = a;
+    }
+    else if (b < a) {
+        runs[a].parent = b;
+    }
+}
+
+void FindMatchBlobs(const MatchTable& table, MatchRowKernel kernel, const BYTE* data, UINT pitch, int width,
+    int height, int minArea, std::vector<MatchBlob>& blobs) {
+    // Reused between frames so labeling doesn't allocate once the vectors have grown
+    thread_local std::vector<BYTE> mask;
+    thread_local std::vector<MatchRun> runs;
+    thread_local std::vector<int> blobOfRun;
+    thread_local std::vector<long long> sums;  // Sum of x and of y per blob, for the centroid
+
+    if (mask.size() < static_cast<size_t>(width)) {
+        mask.resize(width);
+    }
+    runs.clear();
+    blobs.clear();
+
+    int previousBegin = 0;  // Runs of the row above are [previousBegin, previousEnd)
+    int previousEnd = 0;
+    for (int y = 0; y < height; ++y) {
+        kernel(data + y * pitch, width, table, mask.data());
+
+        int rowBegin = static_cast<int>(runs.size());
+        int above = previousBegin;
+        for (int x = 0; x < width;) {
+            if (!mask[x]) {
+                ++x;
+                continue;
+            }
+            int start = x;
+            while (x < width && mask[x]) {
+                ++x;
+            }
+            int run = static_cast<int>(runs.size());
+            runs.push_back({ start, x, y, run });
+
+            // Runs of the row above touch this one, diagonals included, when they overlap
+            // [start - 1, x]. Runs that end before that can't touch any later run of this row.
+            while (above < previousEnd && runs[above].x1 < start) {
+                ++above;
+            }
+            for (int other = above; other < previousEnd && runs[other].x0 <= x; ++other) {
+                UniteRuns(runs, run, other);
+            }
+        }
+        previousBegin = rowBegin;
+        previousEnd = static_cast<int>(runs.size());
+    }
+
+    // A root comes before every other run of its blob, so it always creates the blob
+    blobOfRun.resize(runs.size());
+    sums.clear();
+    for (int run = 0; run < static_cast<int>(runs.size()); ++run) {
+        const MatchRun& current = runs[run];
+        int root = FindRunRoot(runs, run);
+        int length = current.x1 - current.x0;
+
+        if (root == run) {
+            blobOfRun[run] = static_cast<int>(blobs.size());
+            blobs.push_back({ 0, current.x0, current.y, current.x1 - 1, current.y, 0, 0 });
+            sums.push_back(0);
+            sums.push_back(0);
+        }
+        int index = blobOfRun[root];
+        blobOfRun[run] = index;
+
+        MatchBlob& blob = blobs[index];
+        blob.area += length;
+        blob.left = min(blob.left, current.x0);
+        blob.right = max(blob.right, current.x1 - 1);
+        blob.bottom = current.y;
+        sums[index * 2] += static_cast<long long>(length) * (current.x0 + current.x1 - 1) / 2;
+        sums[index * 2 + 1] += static_cast<long long>(length) * current.y;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < blobs.size(); ++i) {
+        MatchBlob blob = blobs[i];
+        if (blob.area < minArea) {
+            continue;
+        }
+        blob.centroidX = static_cast<int>((sums[i * 2] + blob.area / 2) / blob.area);
+        blob.centroidY = static_cast<int>((sums[i * 2 + 1] + blob.area / 2) / blob.area);
+        blobs[kept++] = blob;
+    }
+    blobs.resize(kept);
+}
+
+bool ScanRegion(const ScanSettings& settings, TrackingState& tracking, const BYTE* data, UINT pitch, int width,
+    int height, std::vector<BYTE>& mask, std::vector<MatchBlob>& blobs, int& foundX, int& foundY, MatchBlob& blob) {
+    blob = MatchBlob();
+    if (settings.minBlobArea <= 0) {
+        return ScanPixelsTracked(settings, tracking, data, pitch, width, height, mask, foundX, foundY);
+    }
+
+    foundX = -1;
+    foundY = -1;
+    FindMatchBlobs(settings.table, settings.kernel, data, pitch, width, height, settings.minBlobArea, blobs);
+
+    int centerX = width / 2;
+    int centerY = height / 2;
+    int bestDist = INT_MAX;
+    for (const auto& candidate : blobs) {
+        int dx = candidate.centroidX - centerX;
+        int dy = candidate.centroidY - centerY;
+        int dist = dx * dx + dy * dy;
+        if (dist < bestDist) {
+            bestDist = dist;
+            blob = candidate;
+            if (!settings.findClosest) {
+                break;
+            }
+        }
+    }
+
+    if (blob.area == 0) {
+        return false;
+    }
+    foundX = blob.centroidX;
+    foundY = blob.centroidY;
+    return true;
+}
+
+bool FindMatchInTiles(const ScanSettings& settings, const BYTE* data, UINT pitch, int width, int height,
+    int tileSize, const UINT* tileBits, int firstTile, std::vector<BYTE>& mask, int& foundX, int& foundY) {
+    int tilesPerRow = (width + tileSize - 1) / tileSize;
+    int tileRows = (height + tileSize - 1) / tileSize;
+    int centerX = width / 2;
+    int centerY = height / 2;
+    int bestDist = INT_MAX;
+
+    if (mask.size() < static_cast<size_t>(tileSize)) {
+        mask.resize(tileSize);
+    }
+    foundX = -1;
+    foundY = -1;
+
+    // Tiles are visited in row-major tile order, which isn't pixel row order, so every candidate
+    // is compared by distance and then row and column, like the row-major scan breaks ties
+    for (int tileY = 0; tileY < tileRows; ++tileY) {
+        int top = tileY * tileSize;
+        int bottom = min(height, top + tileSize);
+        if (!settings.findClosest && foundY != -1 && top > foundY) {
+            break;
+        }
+
+        for (int tileX = 0; tileX < tilesPerRow; ++tileX) {
+            int tile = firstTile + tileY * tilesPerRow + tileX;
+            if (!((tileBits[tile >> 5] >> (tile & 31)) & 1)) {
+                continue;
+            }
+            int left = tileX * tileSize;
+            int right = min(width, left + tileSize);
+
+            if (settings.findClosest) {
+                int nearestDx = centerX < left ? left - centerX : (centerX >= right ? centerX - (right - 1) : 0);
+                int nearestDy = centerY < top ? top - centerY : (centerY >= bottom ? centerY - (bottom - 1) : 0);
+                if (nearestDx * nearestDx + nearestDy * nearestDy > bestDist) {
+                    continue;
+                }
+            }
+
+            for (int y = top; y < bottom; ++y) {
+                int dy = y - centerY;
+                if (settings.findClosest && dy * dy > bestDist) {
+                    continue;
+                }
+                if (!settings.findClosest && foundY != -1 && y > foundY) {
+                    break;
+                }
+
+                settings.kernel(data + y * pitch + left * 4, right - left, settings.table, mask.data());
+                for (int x = left; x < right; ++x) {
+                    if (!mask[x - left]) {
+                        continue;
+                    }
+                    bool earlier = foundY == -1 || y < foundY || (y == foundY && x < foundX);
+                    if (settings.findClosest) {
+                        int dx = x - centerX;
+                        int dist = dx * dx + dy * dy;
+                        if (dist < bestDist || (dist == bestDist && earlier)) {
+                            bestDist = dist;
+                            foundX = x;
+                            foundY = y;
+                        }
+                    }
+                    else if (earlier) {
+                        foundX = x;
+                        foundY = y;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    return foundX != -1;
+}
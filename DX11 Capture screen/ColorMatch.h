@@ -0,0 +1,294 @@
+#pragma once
+
+#include <Windows.h>
+#include <dxgiformat.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// CPU side of the color match: match tables, the row matchers, format conversion and the
+// scans that find the matching pixel in a BGRA image. Shared by the capture and the benchmark.
+
+// How pixels are compared with the targets
+enum class MatchMetric {
+    Redmean,    // Redmean distance (ScaledColorDistance) within tolerance
+    Euclidean,  // Plain RGB distance within tolerance
+    HsvRange,   // Hue within hue_tolerance degrees, saturation and value within tolerance (0..255)
+};
+
+struct MatchTarget {
+    int r;
+    int g;
+    int b;
+    // HsvRange only, in the units of HsvTerms
+    int hue;
+    int saturation;
+    int value;
+    int hueRange;  // The table's hue threshold, or half the circle for gray targets, which have no hue
+};
+
+// Target colors and tolerance in the form the matchers consume, rebuilt only when the
+// targets or tolerance change.
+struct MatchTable {
+    std::vector<MatchTarget> targets;
+    MatchMetric metric;
+    // Redmean: 512 * tolerance^2, Euclidean: tolerance^2, HsvRange: tolerance; -1 when nothing can match
+    int threshold;
+
+    // Optional 2^24-bit membership set indexed by (r << 16) | (g << 8) | b, which is the low
+    // 24 bits of a BGRA pixel read as a little-endian UINT. Empty unless BuildMatchLut ran.
+    std::vector<UINT> lut;
+};
+
+// Redmean color distance, squared and scaled by 512 so every term is an exact integer:
+//   512 * d^2 = (1024 + rsum) * dr^2 + 2048 * dg^2 + (1534 - rsum) * db^2,  rsum = r1 + r2
+// Comparing this against 512 * tolerance^2 gives exactly the same decisions as comparing
+// sqrt(d^2) against tolerance, without the floating point math or the sqrt.
+inline int ScaledColorDistance(int r1, int g1, int b1, int r2, int g2, int b2) {
+    int rsum = r1 + r2;
+    int r = r1 - r2;
+    int g = g1 - g2;
+    int b = b1 - b2;
+    return (1024 + rsum) * r * r + 2048 * g * g + (1534 - rsum) * b * b;
+}
+
+inline int SquaredColorDistance(int r1, int g1, int b1, int r2, int g2, int b2) {
+    int r = r1 - r2;
+    int g = g1 - g2;
+    int b = b1 - b2;
+    return r * r + g * g + b * b;
+}
+
+// Hue circle in HsvRange units: 256 per 60 degrees
+static const int HSV_HUE_CIRCLE = 1536;
+
+// HSV of a pixel without any division, so every matcher can test it exactly in integers:
+// value is the largest channel, saturation is 255 * chroma / value and hue is
+// hueNumerator / chroma, from -256 to 1280 (red at 0).
+struct HsvTerms {
+    int value;
+    int chroma;
+    int hueNumerator;
+
+    HsvTerms(int r, int g, int b) {
+        value = max(r, max(g, b));
+        chroma = value - min(r, min(g, b));
+        if (value == r) hueNumerator = 256 * (g - b);
+        else if (value == g) hueNumerator = 256 * (b - r) + 512 * chroma;
+        else hueNumerator = 256 * (r - g) + 1024 * chroma;
+    }
+};
+
+// The range tests with both sides multiplied by value or chroma. Black (value 0) has every
+// saturation and gray (chroma 0) every hue.
+inline bool MatchesHsvTarget(const HsvTerms& pixel, const MatchTarget& target, int threshold) {
+    int saturation255 = 255 * pixel.chroma;
+    int hueDiff = abs(pixel.hueNumerator - target.hue * pixel.chroma);
+    return pixel.value >= target.value - threshold && pixel.value <= target.value + threshold &&
+        saturation255 >= (target.saturation - threshold) * pixel.value &&
+        saturation255 <= (target.saturation + threshold) * pixel.value &&
+        (hueDiff <= target.hueRange * pixel.chroma || hueDiff >= (HSV_HUE_CIRCLE - target.hueRange) * pixel.chroma);
+}
+
+// One metric's test of a pixel against a single target
+template <MatchMetric Metric>
+inline bool MatchesTarget(const MatchTable& table, const MatchTarget& target, int r, int g, int b);
+
+template <>
+inline bool MatchesTarget<MatchMetric::Redmean>(const MatchTable& table, const MatchTarget& target, int r, int g, int b) {
+    return ScaledColorDistance(r, g, b, target.r, target.g, target.b) <= table.threshold;
+}
+
+template <>
+inline bool MatchesTarget<MatchMetric::Euclidean>(const MatchTable& table, const MatchTarget& target, int r, int g, int b) {
+    return SquaredColorDistance(r, g, b, target.r, target.g, target.b) <= table.threshold;
+}
+
+template <>
+inline bool MatchesTarget<MatchMetric::HsvRange>(const MatchTable& table, const MatchTarget& target, int r, int g, int b) {
+    return MatchesHsvTarget(HsvTerms(r, g, b), target, table.threshold);
+}
+
+// Tests against the first Targets targets, or all of them when Targets is 0. With a fixed
+// count the loop is fully unrolled; it ORs instead of returning early so it stays branch-free.
+template <MatchMetric Metric, int Targets>
+inline bool MatchesTargets(const MatchTable& table, int r, int g, int b) {
+    int count = Targets > 0 ? Targets : static_cast<int>(table.targets.size());
+    bool matched = false;
+    for (int i = 0; i < count; ++i) {
+        matched |= MatchesTarget<Metric>(table, table.targets[i], r, g, b);
+    }
+    return matched;
+}
+
+inline bool MatchesTable(const MatchTable& table, int r, int g, int b) {
+    switch (table.metric) {
+    case MatchMetric::Euclidean: return MatchesTargets<MatchMetric::Euclidean, 0>(table, r, g, b);
+    case MatchMetric::HsvRange: return MatchesTargets<MatchMetric::HsvRange, 0>(table, r, g, b);
+    default: return MatchesTargets<MatchMetric::Redmean, 0>(table, r, g, b);
+    }
+}
+
+// hueTolerance is in degrees and only used by HsvRange
+void BuildMatchTable(const std::vector<COLORREF>& colors, int tolerance, MatchMetric metric, int hueTolerance,
+    MatchTable& table);
+void BuildMatchLut(MatchTable& table);
+
+// A BGRA pixel that no target of table matches, for painting over pixels every scan has to
+// skip. False when the tolerance is so large that it matches all the colors tried.
+bool FindUnmatchedPixel(const MatchTable& table, UINT& pixel);
+
+// Pixel matchers: each one tests a row of BGRA pixels against the table and writes 1 (match)
+// or 0 (no match) per pixel into mask. These work for any metric and number of targets.
+typedef void (*MatchRowKernel)(const BYTE* row, int width, const MatchTable& table, BYTE* mask);
+
+void MatchRowScalar(const BYTE* row, int width, const MatchTable& table, BYTE* mask);
+void MatchRowLut(const BYTE* row, int width, const MatchTable& table, BYTE* mask);
+void MatchRowSse41(const BYTE* row, int width, const MatchTable& table, BYTE* mask);
+void MatchRowAvx2(const BYTE* row, int width, const MatchTable& table, BYTE* mask);
+
+bool CpuSupportsSse41();
+bool CpuSupportsAvx2();
+// Picks the widest matcher the CPU and OS support. Tables with up to MAX_FIXED_TARGETS targets
+// get one compiled for their metric and target count; a matcher picked for a table only
+// works with tables of the same metric and count.
+static const int MAX_FIXED_TARGETS = 4;
+MatchRowKernel SelectMatchRowKernel(const MatchTable& table);
+
+inline bool MatchesPixel(const MatchTable& table, const BYTE* pixel) {
+    if (!table.lut.empty()) {
+        UINT index = (pixel[2] << 16) | (pixel[1] << 8) | pixel[0];
+        return ((table.lut[index >> 5] >> (index & 31)) & 1) != 0;
+    }
+    return MatchesTable(table, pixel[2], pixel[1], pixel[0]);
+}
+
+enum class ScanOrder {
+    RowMajor,
+    Spiral,
+};
+
+// Desktop formats DuplicateOutput1 may hand out, in order of preference. Everything that isn't
+// BGRA8 is converted to BGRA8 per analyzed pixel after the copy, instead of having DWM convert
+// the whole desktop.
+static const DXGI_FORMAT DUPLICATION_FORMATS[] = {
+    DXGI_FORMAT_R16G16B16A16_FLOAT,
+    DXGI_FORMAT_R10G10B10A2_UNORM,
+    DXGI_FORMAT_B8G8R8A8_UNORM,
+};
+
+inline UINT BytesPerPixel(DXGI_FORMAT format) {
+    return format == DXGI_FORMAT_R16G16B16A16_FLOAT ? 8 : 4;
+}
+
+void ConvertRowToBgra8(DXGI_FORMAT format, const BYTE* source, int width, BYTE* destination);
+// 65536 entries, the sRGB value ConvertRowToBgra8 gives each half float bit pattern
+const BYTE* GetHalfToSrgbTable();
+
+bool FindMatchRowMajor(const BYTE* data, UINT pitch, int width, int height, const MatchTable& table,
+    MatchRowKernel kernel, bool findClosest, BYTE* mask, int& foundX, int& foundY);
+bool FindMatchSpiral(const BYTE* data, UINT pitch, int width, int height, const MatchTable& table,
+    int& foundX, int& foundY);
+
+// Persistent worker threads that a scan can split into row bands. The calling thread works on
+// bands as well, so a pool with N - 1 workers keeps N cores busy, and no thread is created
+// per frame.
+class ScanThreadPool {
+public:
+    typedef void (*Task)(void* context, int index);
+
+    explicit ScanThreadPool(int threadCount);
+    ~ScanThreadPool();
+
+    int GetThreadCount() const;
+    // Calls task(context, i) for every i in [0, count) and returns once all calls have finished.
+    // Runs from several threads (one per captured output) take turns.
+    void Run(Task task, void* context, int count);
+
+private:
+    void WorkerLoop();
+    void RunTasks(Task currentTask, void* currentContext, int currentCount);
+
+    std::vector<std::thread> workers;
+    std::mutex runMutex;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    unsigned long long generation;  // Bumped by every Run so sleeping workers know there is work
+    bool exiting;
+    int activeWorkers;              // Workers that still hold the current task
+
+    Task task;
+    void* context;
+    int count;
+    std::atomic<int> nextIndex;
+    std::atomic<int> remaining;
+};
+
+std::shared_ptr<ScanThreadPool> GetSharedScanPool(int threadCount);
+
+// Immutable snapshot of everything a CPU scan needs. Frames in flight keep a reference to the
+// settings they were captured with, so a config change never races with a running scan.
+struct ScanSettings {
+    MatchTable table;
+    MatchRowKernel kernel;
+    ScanOrder order;
+    bool findClosest;
+    std::shared_ptr<ScanThreadPool> pool;  // Splits row-major scans into bands, null = single-threaded
+    int trackingWindow;                    // Side of the window ScanPixelsTracked tries first, 0 = off
+    int minBlobArea;                       // ScanRegion reports blobs of at least this many pixels, 0 = single pixels
+};
+
+// What ScanPixelsTracked remembers of one region between frames
+struct TrackingState {
+    bool hasMatch;  // The previous scan found something
+    int lastX;
+    int lastY;
+    int motionX;    // Offset between the last two matches found in consecutive frames
+    int motionY;
+
+    TrackingState();
+};
+
+bool FindMatchTiled(const ScanSettings& settings, const BYTE* data, UINT pitch, int width, int height,
+    int& foundX, int& foundY);
+bool ScanPixels(const ScanSettings& settings, const BYTE* data, UINT pitch, int width, int height,
+    std::vector<BYTE>& mask, int& foundX, int& foundY);
+// Like ScanPixels, but with tracking enabled in settings and a match in the previous frame it
+// first scans a trackingWindow square around where that match is predicted to be now, and only
+// scans the whole image when the window has no match.
+bool ScanPixelsTracked(const ScanSettings& settings, TrackingState& state, const BYTE* data, UINT pitch,
+    int width, int height, std::vector<BYTE>& mask, int& foundX, int& foundY);
+
+// A group of matching pixels connected through any of their 8 neighbours
+struct MatchBlob {
+    int area;       // Matching pixels in the blob
+    int left;       // Bounding box, inclusive
+    int top;
+    int right;
+    int bottom;
+    int centroidX;  // Mean pixel position, rounded
+    int centroidY;
+};
+
+// Labels the matching pixels of a width x height BGRA image while it is matched, one row at a
+// time: each row's runs of matching pixels are joined (union-find) with the runs they touch in
+// the row above. blobs receives every blob of at least minArea pixels, in the row order of
+// their first pixel.
+void FindMatchBlobs(const MatchTable& table, MatchRowKernel kernel, const BYTE* data, UINT pitch, int width,
+    int height, int minArea, std::vector<MatchBlob>& blobs);
+
+// Runs the scan settings ask for. With minBlobArea set, (foundX, foundY) is the centroid of the
+// blob closest to the center (or the first blob without findClosest) and blob describes it;
+// otherwise it is the pixel ScanPixelsTracked finds and blob.area is 0. blobs is scratch space.
+bool ScanRegion(const ScanSettings& settings, TrackingState& tracking, const BYTE* data, UINT pitch, int width,
+    int height, std::vector<BYTE>& mask, std::vector<MatchBlob>& blobs, int& foundX, int& foundY, MatchBlob& blob);
+
+// Scans only the tileSize x tileSize tiles (row-major, bit firstTile + i of tileBits for tile i)
+// that are flagged, without reading any pixel of the others. Returns the same pixel as
+// FindMatchRowMajor as long as every matching pixel lies in a flagged tile.
+bool FindMatchInTiles(const ScanSettings& settings, const BYTE* data, UINT pitch, int width, int height,
+    int tileSize, const UINT* tileBits, int firstTile, std::vector<BYTE>& mask, int& foundX, int& foundY);
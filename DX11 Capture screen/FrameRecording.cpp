@@ -0,0 +1,261 @@
+#include "FrameRecording.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+// Rle tokens are UINT32s: (count << 1) | 1 is followed by one pixel repeated count times,
+// (count << 1) by count literal pixels. Only runs of at least this many pixels are worth a token.
+static const size_t MIN_RUN = 3;
+static const size_t MAX_TOKEN_COUNT = 0x7FFFFFFF;
+
+RecordEncoding EncodeRecordPixels(const UINT* pixels, const UINT* previous, size_t count, std::vector<BYTE>& payload) {
+    auto value = [pixels, previous](size_t i) {
+        return previous ? pixels[i] ^ previous[i] : pixels[i];
+    };
+    auto runLength = [&](size_t start) {
+        size_t end = start + 1;
+        while (end < count && end - start < MAX_TOKEN_COUNT && value(end) == value(start)) {
+            ++end;
+        }
+        return end - start;
+    };
+
+    std::vector<UINT> tokens;
+    tokens.reserve(count / 4);
+    size_t rawWords = count;
+    size_t i = 0;
+    while (i < count && tokens.size() < rawWords) {
+        size_t run = runLength(i);
+        if (run >= MIN_RUN) {
+            tokens.push_back(static_cast<UINT>(run << 1) | 1);
+            tokens.push_back(value(i));
+            i += run;
+            continue;
+        }
+
+        // Literals up to the next run worth a token
+        size_t start = i;
+        while (i < count && i - start < MAX_TOKEN_COUNT && runLength(i) < MIN_RUN) {
+            ++i;
+        }
+        tokens.push_back(static_cast<UINT>((i - start) << 1));
+        for (size_t j = start; j < i; ++j) {
+            tokens.push_back(value(j));
+        }
+    }
+
+    if (tokens.size() >= rawWords) {
+        payload.resize(count * sizeof(UINT));
+        memcpy(payload.data(), pixels, payload.size());
+        return RecordEncoding::Raw;
+    }
+    payload.resize(tokens.size() * sizeof(UINT));
+    memcpy(payload.data(), tokens.data(), payload.size());
+    return previous ? RecordEncoding::DeltaRle : RecordEncoding::Rle;
+}
+
+bool DecodeRecordPixels(const RecordHeader& header, const BYTE* payload, const UINT* previous, std::vector<UINT>& pixels) {
+    if (header.width <= 0 || header.height <= 0) {
+        return false;
+    }
+    size_t count = static_cast<size_t>(header.width) * header.height;
+    pixels.resize(count);
+
+    if (header.encoding == RecordEncoding::Raw) {
+        if (header.payloadSize != count * sizeof(UINT)) {
+            return false;
+        }
+        memcpy(pixels.data(), payload, header.payloadSize);
+        return true;
+    }
+    if ((header.encoding != RecordEncoding::Rle && header.encoding != RecordEncoding::DeltaRle) ||
+        (header.encoding == RecordEncoding::DeltaRle && !previous) || header.payloadSize % sizeof(UINT) != 0) {
+        return false;
+    }
+
+    const UINT* tokens = reinterpret_cast<const UINT*>(payload);
+    size_t tokenCount = header.payloadSize / sizeof(UINT);
+    size_t written = 0;
+    for (size_t t = 0; t < tokenCount;) {
+        size_t run = tokens[t] >> 1;
+        bool repeat = (tokens[t] & 1) != 0;
+        ++t;
+        if (run > count - written || t + (repeat ? 1 : run) > tokenCount) {
+            return false;
+        }
+        if (repeat) {
+            std::fill(pixels.begin() + written, pixels.begin() + written + run, tokens[t]);
+            ++t;
+        }
+        else {
+            memcpy(&pixels[written], &tokens[t], run * sizeof(UINT));
+            t += run;
+        }
+        written += run;
+    }
+    if (written != count) {
+        return false;
+    }
+
+    if (header.encoding == RecordEncoding::DeltaRle) {
+        for (size_t i = 0; i < count; ++i) {
+            pixels[i] ^= previous[i];
+        }
+    }
+    return true;
+}
+
+RecordingWriter::RecordingWriter() : file(INVALID_HANDLE_VALUE), mapping(nullptr), header(nullptr), ring(nullptr) {
+}
+
+RecordingWriter::~RecordingWriter() {
+    Close();
+}
+
+bool RecordingWriter::Open(const std::string& path, UINT64 capacity) {
+    Close();
+
+    // Record sizes are 32-bit, and so are wrap markers covering the rest of the ring
+    capacity = min(capacity, static_cast<UINT64>(0xFFFFFFF8)) & ~static_cast<UINT64>(7);
+    UINT64 total = sizeof(RecordingHeader) + capacity;
+
+    std::wstring widePath(path.begin(), path.end());
+    file = CreateFileW(widePath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        std::cerr << "Failed to create recording " << path << ". Error: " << GetLastError() << std::endl;
+        return false;
+    }
+    mapping = CreateFileMappingW(file, nullptr, PAGE_READWRITE, static_cast<DWORD>(total >> 32), static_cast<DWORD>(total), nullptr);
+    void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0) : nullptr;
+    if (!view) {
+        std::cerr << "Failed to map recording " << path << ". Error: " << GetLastError() << std::endl;
+        Close();
+        return false;
+    }
+
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+
+    header = static_cast<RecordingHeader*>(view);
+    memset(header, 0, sizeof(RecordingHeader));
+    header->magic = RECORDING_MAGIC;
+    header->version = RECORDING_VERSION;
+    header->capacity = capacity;
+    header->qpcFrequency = frequency.QuadPart;
+    ring = static_cast<BYTE*>(view) + sizeof(RecordingHeader);
+    return true;
+}
+
+void RecordingWriter::Close() {
+    if (header) UnmapViewOfFile(header);
+    if (mapping) CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+    header = nullptr;
+    ring = nullptr;
+    mapping = nullptr;
+    file = INVALID_HANDLE_VALUE;
+}
+
+bool RecordingWriter::IsOpen() const {
+    return header != nullptr;
+}
+
+// Moves oldestOffset past every record that writing up to end would overwrite
+void RecordingWriter::Evict(UINT64 end) {
+    while (end - header->oldestOffset > header->capacity) {
+        UINT32 size;
+        memcpy(&size, ring + header->oldestOffset % header->capacity + sizeof(UINT32), sizeof(size));
+        header->oldestOffset += size;
+    }
+}
+
+bool RecordingWriter::Append(RecordHeader record, const BYTE* payload) {
+    UINT64 capacity = header->capacity;
+    UINT64 size = (sizeof(RecordHeader) + record.payloadSize + 7) & ~static_cast<UINT64>(7);
+    if (size > capacity) {
+        return false;
+    }
+    record.magic = RECORD_MAGIC;
+    record.size = static_cast<UINT32>(size);
+
+    UINT64 position = header->writeOffset % capacity;
+    if (position + size > capacity) {
+        // Skip to the start of the ring instead of splitting the record
+        UINT64 remaining = capacity - position;
+        Evict(header->writeOffset + remaining);
+        UINT32 wrap[2] = { RECORD_WRAP_MAGIC, static_cast<UINT32>(remaining) };
+        memcpy(ring + position, wrap, sizeof(wrap));
+        header->writeOffset += remaining;
+        position = 0;
+    }
+
+    Evict(header->writeOffset + size);
+    memcpy(ring + position, &record, sizeof(record));
+    memcpy(ring + position + sizeof(record), payload, record.payloadSize);
+    // Readers of a live recording only look at records below writeOffset
+    MemoryBarrier();
+    header->writeOffset += size;
+    return true;
+}
+
+bool RecordingReader::Open(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+    contents.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(contents.data()), contents.size());
+
+    RecordingHeader header;
+    if (!file || contents.size() < sizeof(header)) {
+        std::cerr << path << " is not a recording" << std::endl;
+        return false;
+    }
+    memcpy(&header, contents.data(), sizeof(header));
+    if (header.magic != RECORDING_MAGIC || header.version != RECORDING_VERSION ||
+        contents.size() < sizeof(header) + header.capacity || header.capacity == 0) {
+        std::cerr << path << " is not a version " << RECORDING_VERSION << " recording" << std::endl;
+        return false;
+    }
+
+    capacity = header.capacity;
+    offset = header.oldestOffset;
+    endOffset = header.writeOffset;
+    return true;
+}
+
+bool RecordingReader::Next(RecordHeader& header, const BYTE*& payload) {
+    const BYTE* ring = contents.data() + sizeof(RecordingHeader);
+    while (offset < endOffset) {
+        UINT64 position = offset % capacity;
+        UINT32 marker[2];
+        if (position + sizeof(marker) > capacity) {
+            return false;
+        }
+        memcpy(marker, ring + position, sizeof(marker));
+        if (marker[1] < sizeof(marker) || position + marker[1] > capacity) {
+            return false;
+        }
+        if (marker[0] == RECORD_WRAP_MAGIC) {
+            offset += marker[1];
+            continue;
+        }
+        if (marker[0] != RECORD_MAGIC || marker[1] < sizeof(RecordHeader)) {
+            return false;
+        }
+
+        memcpy(&header, ring + position, sizeof(header));
+        if (sizeof(RecordHeader) + header.payloadSize > header.size) {
+            return false;
+        }
+        payload = ring + position + sizeof(RecordHeader);
+        offset += header.size;
+        return true;
+    }
+    return false;
+}
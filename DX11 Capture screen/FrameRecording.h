@@ -0,0 +1,94 @@
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <vector>
+
+// Capture recordings: a fixed-size, memory-mapped file used as an append-only ring of region
+// records, overwriting the oldest records once it is full. The capture writes them
+// (record_path), the benchmark replays them (--replay).
+
+static const UINT32 RECORDING_MAGIC = 0x46525844;  // "DXRF"
+static const UINT32 RECORDING_VERSION = 1;
+static const UINT32 RECORD_MAGIC = 0x52525844;     // "DXRR"
+static const UINT32 RECORD_WRAP_MAGIC = 0x57525844;  // "DXRW", the rest of the ring up to its end is unused
+
+enum class RecordEncoding : UINT32 {
+    Raw,       // width * height BGRA pixels
+    Rle,       // Runs of equal pixels, see EncodeRecordPixels
+    DeltaRle,  // Rle of the XOR with the region's previous record
+};
+
+// Start of the file, followed by capacity bytes of ring
+struct RecordingHeader {
+    UINT32 magic;
+    UINT32 version;
+    UINT64 capacity;
+    LONG64 qpcFrequency;
+    volatile UINT64 writeOffset;   // Bytes ever appended; the ring position is this modulo capacity
+    volatile UINT64 oldestOffset;  // Offset of the oldest record still in the ring
+    UINT64 padding[3];
+};
+
+// One region of one analyzed frame, followed by payloadSize bytes of pixels in the given
+// encoding. size covers both, rounded up to 8 bytes; records never wrap around the ring's end.
+struct RecordHeader {
+    UINT32 magic;
+    UINT32 size;
+    LONG64 presentTime;   // QPC LastPresentTime of the frame, 0 if unknown
+    LONG64 captureTime;   // QPC time the frame was scanned
+    INT32 desktopX;       // Desktop coordinates of the region's pixel (0, 0)
+    INT32 desktopY;
+    INT32 width;
+    INT32 height;
+    RecordEncoding encoding;
+    UINT32 payloadSize;
+    INT32 matchX;         // Match in region coordinates, -1 for no match
+    INT32 matchY;
+    char region[32];      // Region name, empty for the unnamed default region
+};
+
+// Writes pixels (count BGRA pixels) to payload as Rle, or as DeltaRle against previous when it
+// isn't null, falling back to Raw when that doesn't come out smaller. Returns the encoding used.
+RecordEncoding EncodeRecordPixels(const UINT* pixels, const UINT* previous, size_t count, std::vector<BYTE>& payload);
+// Decodes the payload of header into pixels; DeltaRle records need the region's previous
+// pixels. False for a corrupt payload.
+bool DecodeRecordPixels(const RecordHeader& header, const BYTE* payload, const UINT* previous, std::vector<UINT>& pixels);
+
+class RecordingWriter {
+public:
+    RecordingWriter();
+    ~RecordingWriter();
+
+    // Creates (or truncates) the file with a ring of capacity bytes
+    bool Open(const std::string& path, UINT64 capacity);
+    void Close();
+    bool IsOpen() const;
+
+    // Appends header and its payload, evicting the oldest records to make room. magic and size
+    // are filled in; records larger than the ring are dropped.
+    bool Append(RecordHeader header, const BYTE* payload);
+
+private:
+    void Evict(UINT64 end);
+
+    HANDLE file;
+    HANDLE mapping;
+    RecordingHeader* header;
+    BYTE* ring;
+};
+
+// Reads a recording, oldest record first. Meant for recordings that are no longer being
+// written; for a live one the newest record may be torn and is then where reading stops.
+class RecordingReader {
+public:
+    bool Open(const std::string& path);
+    // The next record and its payload, false at the end
+    bool Next(RecordHeader& header, const BYTE*& payload);
+
+private:
+    std::vector<BYTE> contents;
+    UINT64 capacity;
+    UINT64 offset;
+    UINT64 endOffset;
+};
@@ -0,0 +1,515 @@
+#include "GpuColorMatcher.h"
+
+#include <d3dcompiler.h>
+#include <cstring>
+#include <iostream>
+
+#pragma comment(lib, "d3dcompiler.lib")
+
+// Compute shader used by GpuColorMatcher, evaluating the same tests as MatchesTarget.
+static const char GPU_MATCH_SHADER[] = R"(
+#define MAX_TARGETS 64
+
+Texture2D<float4> Desktop : register(t0);
+Buffer<uint> HalfToSrgb : register(t1);  // GetHalfToSrgbTable
+RWByteAddressBuffer Result : register(u0);
+RWByteAddressBuffer Tiles : register(u1);
+
+cbuffer MatchConstants : register(b0) {
+    uint2 Origin;
+    uint2 Size;
+    int2 Center;
+    uint TargetCount;
+    uint Threshold;
+    uint Pass;
+    uint Encoding;  // 0 = 8-bit, 1 = 10-bit UNORM, 2 = linear scRGB half float
+    uint TileSize;
+    uint TilesPerRow;
+    uint FirstTile;
+    uint Metric;    // MatchMetric: 0 = redmean, 1 = Euclidean, 2 = HSV range
+    uint2 Padding;
+    uint4 Targets[MAX_TARGETS];
+    int4 TargetHsv[MAX_TARGETS];  // hue, saturation, value, hueRange for the HSV range
+};
+
+// Same conversions as ConvertRowToBgra8. Half floats load exactly, so f32tof16 gives back the
+// texel's bits and the CPU's table lookup can be repeated as is.
+int3 LoadPixel(uint2 position) {
+    float3 color = Desktop.Load(int3(position, 0)).rgb;
+    if (Encoding == 1) {
+        return int3(uint3(round(color * 1023.0)) >> 2);
+    }
+    if (Encoding == 2) {
+        uint3 bits = f32tof16(color);
+        return int3(HalfToSrgb[bits.r], HalfToSrgb[bits.g], HalfToSrgb[bits.b]);
+    }
+    return int3(round(color * 255.0));
+}
+
+[numthreads(8, 8, 1)]
+void main(uint3 id : SV_DispatchThreadID) {
+    if (id.x >= Size.x || id.y >= Size.y) {
+        return;
+    }
+
+    int3 pixel = LoadPixel(Origin + id.xy);
+
+    // HsvTerms
+    int value = max(pixel.r, max(pixel.g, pixel.b));
+    int chroma = value - min(pixel.r, min(pixel.g, pixel.b));
+    int hueNumerator = value == pixel.r ? 256 * (pixel.g - pixel.b) :
+        (value == pixel.g ? 256 * (pixel.b - pixel.r) + 512 * chroma : 256 * (pixel.r - pixel.g) + 1024 * chroma);
+
+    bool match = false;
+    for (uint i = 0; i < TargetCount && !match; ++i) {
+        int3 target = int3(Targets[i].rgb);
+        int3 d = pixel - target;
+        if (Metric == 2) {
+            int4 hsv = TargetHsv[i];
+            int threshold = int(Threshold);
+            int hueDiff = abs(hueNumerator - hsv.x * chroma);
+            match = value >= hsv.z - threshold && value <= hsv.z + threshold &&
+                255 * chroma >= (hsv.y - threshold) * value && 255 * chroma <= (hsv.y + threshold) * value &&
+                (hueDiff <= hsv.w * chroma || hueDiff >= (1536 - hsv.w) * chroma);
+        }
+        else if (Metric == 1) {
+            match = uint(d.r * d.r + d.g * d.g + d.b * d.b) <= Threshold;
+        }
+        else {
+            int rsum = pixel.r + target.r;
+            uint dist = uint((1024 + rsum) * d.r * d.r + 2048 * d.g * d.g + (1534 - rsum) * d.b * d.b);
+            match = dist <= Threshold;
+        }
+    }
+    if (!match) {
+        return;
+    }
+
+    // Pass 3: flag the tile the pixel is in
+    if (Pass == 3) {
+        uint tile = FirstTile + (id.y / TileSize) * TilesPerRow + id.x / TileSize;
+        Tiles.InterlockedOr((tile >> 5) * 4, 1u << (tile & 31));
+        return;
+    }
+
+    int2 offset = int2(id.xy) - Center;
+    uint centerDist = uint(offset.x * offset.x + offset.y * offset.y);
+    uint index = id.y * Size.x + id.x;
+
+    // Pass 0: closest distance to the center.
+    // Pass 1: first pixel (in row order) at that distance.
+    // Pass 2: first matching pixel regardless of distance.
+    if (Pass == 0) {
+        Result.InterlockedMin(0, centerDist);
+    }
+    else if (Pass == 2 || centerDist == Result.Load(0)) {
+        Result.InterlockedMin(4, index);
+    }
+}
+)";
+
+GpuColorMatcher::GpuColorMatcher() :
+    device(nullptr), shader(nullptr), constantBuffer(nullptr), resultBuffer(nullptr),
+    resultView(nullptr), readbackBuffer(nullptr), resultWidth(0), resultEmpty(false),
+    tileBuffer(nullptr), tileView(nullptr), tileReadbackBuffer(nullptr), srgbBuffer(nullptr), srgbView(nullptr),
+    viewSource(nullptr), sourceView(nullptr), sourceEncoding(0) {
+}
+
+GpuColorMatcher::~GpuColorMatcher() {
+    CleanUp();
+}
+
+HRESULT GpuColorMatcher::Initialize(ID3D11Device* d3dDevice) {
+    HRESULT hr;
+
+    CleanUp();
+
+    if (d3dDevice->GetFeatureLevel() < D3D_FEATURE_LEVEL_11_0) {
+        std::cerr << "GPU matcher requires feature level 11_0." << std::endl;
+        return E_NOTIMPL;
+    }
+
+    device = d3dDevice;
+    device->AddRef();
+
+    // Compile the compute shader
+    ID3DBlob* shaderBlob = nullptr;
+    ID3DBlob* errorBlob = nullptr;
+    hr = D3DCompile(GPU_MATCH_SHADER, sizeof(GPU_MATCH_SHADER) - 1, "GpuColorMatcher", nullptr, nullptr,
+        "main", "cs_5_0", D3DCOMPILE_OPTIMIZATION_LEVEL3, 0, &shaderBlob, &errorBlob);
+    if (FAILED(hr)) {
+        std::cerr << "Failed to compile match shader. HRESULT: " << std::hex << hr << std::endl;
+        if (errorBlob) {
+            std::cerr << static_cast<const char*>(errorBlob->GetBufferPointer()) << std::endl;
+            errorBlob->Release();
+        }
+        return hr;
+    }
+    if (errorBlob) errorBlob->Release();
+
+    hr = device->CreateComputeShader(shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize(), nullptr, &shader);
+    shaderBlob->Release();
+    if (FAILED(hr)) {
+        std::cerr << "Failed to create match shader. HRESULT: " << std::hex << hr << std::endl;
+        return hr;
+    }
+
+    D3D11_BUFFER_DESC constantDesc = {};
+    constantDesc.ByteWidth = sizeof(MatchConstants);
+    constantDesc.Usage = D3D11_USAGE_DYNAMIC;
+    constantDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+    constantDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    hr = device->CreateBuffer(&constantDesc, nullptr, &constantBuffer);
+    if (FAILED(hr)) {
+        std::cerr << "Failed to create match constant buffer. HRESULT: " << std::hex << hr << std::endl;
+        return hr;
+    }
+
+    // Result layout: [0] closest squared distance to the center, [1] linear pixel index
+    D3D11_BUFFER_DESC resultDesc = {};
+    resultDesc.ByteWidth = 2 * sizeof(UINT);
+    resultDesc.Usage = D3D11_USAGE_DEFAULT;
+    resultDesc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+    resultDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
+    hr = device->CreateBuffer(&resultDesc, nullptr, &resultBuffer);
+    if (FAILED(hr)) {
+        std::cerr << "Failed to create match result buffer. HRESULT: " << std::hex << hr << std::endl;
+        return hr;
+    }
+
+    D3D11_UNORDERED_ACCESS_VIEW_DESC viewDesc = {};
+    viewDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+    viewDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+    viewDesc.Buffer.FirstElement = 0;
+    viewDesc.Buffer.NumElements = 2;
+    viewDesc.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_RAW;
+    hr = device->CreateUnorderedAccessView(resultBuffer, &viewDesc, &resultView);
+    if (FAILED(hr)) {
+        std::cerr << "Failed to create match result view. HRESULT: " << std::hex << hr << std::endl;
+        return hr;
+    }
+
+    D3D11_BUFFER_DESC readbackDesc = {};
+    readbackDesc.ByteWidth = 2 * sizeof(UINT);
+    readbackDesc.Usage = D3D11_USAGE_STAGING;
+    readbackDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+    hr = device->CreateBuffer(&readbackDesc, nullptr, &readbackBuffer);
+    if (FAILED(hr)) {
+        std::cerr << "Failed to create match readback buffer. HRESULT: " << std::hex << hr << std::endl;
+        return hr;
+    }
+
+    D3D11_BUFFER_DESC tileDesc = resultDesc;
+    tileDesc.ByteWidth = MAX_TILES / 8;
+    hr = device->CreateBuffer(&tileDesc, nullptr, &tileBuffer);
+    if (FAILED(hr)) {
+        std::cerr << "Failed to create tile buffer. HRESULT: " << std::hex << hr << std::endl;
+        return hr;
+    }
+
+    D3D11_UNORDERED_ACCESS_VIEW_DESC tileViewDesc = viewDesc;
+    tileViewDesc.Buffer.NumElements = MAX_TILES / 32;
+    hr = device->CreateUnorderedAccessView(tileBuffer, &tileViewDesc, &tileView);
+    if (FAILED(hr)) {
+        std::cerr << "Failed to create tile view. HRESULT: " << std::hex << hr << std::endl;
+        return hr;
+    }
+
+    D3D11_BUFFER_DESC tileReadbackDesc = readbackDesc;
+    tileReadbackDesc.ByteWidth = MAX_TILES / 8;
+    hr = device->CreateBuffer(&tileReadbackDesc, nullptr, &tileReadbackBuffer);
+    if (FAILED(hr)) {
+        std::cerr << "Failed to create tile readback buffer. HRESULT: " << std::hex << hr << std::endl;
+        return hr;
+    }
+
+    D3D11_BUFFER_DESC srgbDesc = {};
+    srgbDesc.ByteWidth = 65536;
+    srgbDesc.Usage = D3D11_USAGE_IMMUTABLE;
+    srgbDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    D3D11_SUBRESOURCE_DATA srgbData = {};
+    srgbData.pSysMem = GetHalfToSrgbTable();
+    hr = device->CreateBuffer(&srgbDesc, &srgbData, &srgbBuffer);
+    if (FAILED(hr)) {
+        std::cerr << "Failed to create sRGB table buffer. HRESULT: " << std::hex << hr << std::endl;
+        return hr;
+    }
+
+    D3D11_SHADER_RESOURCE_VIEW_DESC srgbViewDesc = {};
+    srgbViewDesc.Format = DXGI_FORMAT_R8_UINT;
+    srgbViewDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+    srgbViewDesc.Buffer.FirstElement = 0;
+    srgbViewDesc.Buffer.NumElements = 65536;
+    hr = device->CreateShaderResourceView(srgbBuffer, &srgbViewDesc, &srgbView);
+    if (FAILED(hr)) {
+        std::cerr << "Failed to create sRGB table view. HRESULT: " << std::hex << hr << std::endl;
+        return hr;
+    }
+
+    return S_OK;
+}
+
+bool GpuColorMatcher::IsInitialized() const {
+    return shader != nullptr;
+}
+
+// Keeps a shader view of source, recreated only when the source texture changes
+HRESULT GpuColorMatcher::BindSource(ID3D11Texture2D* source) {
+    if (source == viewSource) {
+        return S_OK;
+    }
+
+    ReleaseSourceView();
+
+    HRESULT hr = device->CreateShaderResourceView(source, nullptr, &sourceView);
+    if (FAILED(hr)) {
+        std::cerr << "Failed to create desktop shader view. HRESULT: " << std::hex << hr << std::endl;
+        return hr;
+    }
+    viewSource = source;
+
+    D3D11_TEXTURE2D_DESC sourceDesc;
+    source->GetDesc(&sourceDesc);
+    sourceEncoding = sourceDesc.Format == DXGI_FORMAT_R10G10B10A2_UNORM ? 1 :
+        (sourceDesc.Format == DXGI_FORMAT_R16G16B16A16_FLOAT ? 2 : 0);
+    return S_OK;
+}
+
+void GpuColorMatcher::FillConstants(MatchConstants& constants, UINT left, UINT top, int width, int height,
+    const MatchTable& table) {
+    constants = MatchConstants();
+    constants.originX = left;
+    constants.originY = top;
+    constants.sizeX = width;
+    constants.sizeY = height;
+    constants.centerX = width / 2;
+    constants.centerY = height / 2;
+    constants.targetCount = static_cast<UINT>(table.targets.size());
+    constants.threshold = static_cast<UINT>(table.threshold);
+    constants.encoding = sourceEncoding;
+    constants.metric = static_cast<UINT>(table.metric);
+    for (size_t i = 0; i < table.targets.size(); ++i) {
+        constants.targets[i][0] = table.targets[i].r;
+        constants.targets[i][1] = table.targets[i].g;
+        constants.targets[i][2] = table.targets[i].b;
+        constants.targetHsv[i][0] = table.targets[i].hue;
+        constants.targetHsv[i][1] = table.targets[i].saturation;
+        constants.targetHsv[i][2] = table.targets[i].value;
+        constants.targetHsv[i][3] = table.targets[i].hueRange;
+    }
+}
+
+HRESULT GpuColorMatcher::RunPass(ID3D11DeviceContext* context, MatchConstants& constants, UINT pass) {
+    constants.pass = pass;
+
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    HRESULT hr = context->Map(constantBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+    if (FAILED(hr)) {
+        return hr;
+    }
+    memcpy(mapped.pData, &constants, sizeof(constants));
+    context->Unmap(constantBuffer, 0);
+
+    context->Dispatch((constants.sizeX + 7) / 8, (constants.sizeY + 7) / 8, 1);
+    return S_OK;
+}
+
+HRESULT GpuColorMatcher::Submit(ID3D11DeviceContext* context, ID3D11Texture2D* source,
+    UINT left, UINT top, int width, int height, const MatchTable& table, bool findClosest) {
+    HRESULT hr;
+
+    resultWidth = 0;
+
+    if (!shader) {
+        return E_FAIL;
+    }
+    if (table.targets.size() > MAX_TARGETS) {
+        return E_INVALIDARG;
+    }
+    if (table.targets.empty() || table.threshold < 0) {
+        resultWidth = width;
+        resultEmpty = true;
+        return S_OK;
+    }
+
+    hr = BindSource(source);
+    if (FAILED(hr)) {
+        return hr;
+    }
+
+    MatchConstants constants;
+    FillConstants(constants, left, top, width, height, table);
+
+    const UINT clearValue[4] = { 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF };
+    context->ClearUnorderedAccessViewUint(resultView, clearValue);
+
+    ID3D11ShaderResourceView* sourceViews[2] = { sourceView, srgbView };
+    context->CSSetShader(shader, nullptr, 0);
+    context->CSSetShaderResources(0, 2, sourceViews);
+    context->CSSetUnorderedAccessViews(0, 1, &resultView, nullptr);
+    context->CSSetConstantBuffers(0, 1, &constantBuffer);
+
+    if (findClosest) {
+        hr = RunPass(context, constants, 0);
+        if (SUCCEEDED(hr)) {
+            hr = RunPass(context, constants, 1);
+        }
+    }
+    else {
+        hr = RunPass(context, constants, 2);
+    }
+
+    ID3D11ShaderResourceView* nullViews[2] = { nullptr, nullptr };
+    ID3D11UnorderedAccessView* nullUav = nullptr;
+    context->CSSetShaderResources(0, 2, nullViews);
+    context->CSSetUnorderedAccessViews(0, 1, &nullUav, nullptr);
+    context->CSSetShader(nullptr, nullptr, 0);
+
+    if (FAILED(hr)) {
+        return hr;
+    }
+
+    context->CopyResource(readbackBuffer, resultBuffer);
+    resultWidth = width;
+    resultEmpty = false;
+    return S_OK;
+}
+
+HRESULT GpuColorMatcher::ReadResult(ID3D11DeviceContext* context, int& foundX, int& foundY) {
+    foundX = -1;
+    foundY = -1;
+
+    if (resultWidth == 0) {
+        return E_FAIL;
+    }
+    int width = resultWidth;
+    resultWidth = 0;
+    if (resultEmpty) {
+        return S_OK;
+    }
+
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    HRESULT hr = context->Map(readbackBuffer, 0, D3D11_MAP_READ, 0, &mapped);
+    if (FAILED(hr)) {
+        return hr;
+    }
+    UINT index = static_cast<const UINT*>(mapped.pData)[1];
+    context->Unmap(readbackBuffer, 0);
+
+    if (index != 0xFFFFFFFF) {
+        foundX = static_cast<int>(index % width);
+        foundY = static_cast<int>(index / width);
+    }
+
+    return S_OK;
+}
+
+HRESULT GpuColorMatcher::BeginTileScan(ID3D11DeviceContext* context) {
+    if (!shader) {
+        return E_FAIL;
+    }
+    const UINT clearValue[4] = { 0, 0, 0, 0 };
+    context->ClearUnorderedAccessViewUint(tileView, clearValue);
+    return S_OK;
+}
+
+HRESULT GpuColorMatcher::SubmitTileScan(ID3D11DeviceContext* context, ID3D11Texture2D* source,
+    UINT left, UINT top, int width, int height, const MatchTable& table, int tileSize, UINT firstTile) {
+    HRESULT hr;
+
+    if (!shader || tileSize < 1) {
+        return E_FAIL;
+    }
+    if (table.targets.size() > MAX_TARGETS) {
+        return E_INVALIDARG;
+    }
+    UINT tilesPerRow = (width + tileSize - 1) / tileSize;
+    UINT tileRows = (height + tileSize - 1) / tileSize;
+    if (firstTile + tilesPerRow * tileRows > MAX_TILES) {
+        return E_INVALIDARG;
+    }
+    if (table.targets.empty() || table.threshold < 0) {
+        return S_OK;  // Nothing can match, every tile stays clear
+    }
+
+    hr = BindSource(source);
+    if (FAILED(hr)) {
+        return hr;
+    }
+
+    MatchConstants constants;
+    FillConstants(constants, left, top, width, height, table);
+    constants.tileSize = tileSize;
+    constants.tilesPerRow = tilesPerRow;
+    constants.firstTile = firstTile;
+
+    ID3D11ShaderResourceView* sourceViews[2] = { sourceView, srgbView };
+    ID3D11UnorderedAccessView* views[2] = { resultView, tileView };
+    context->CSSetShader(shader, nullptr, 0);
+    context->CSSetShaderResources(0, 2, sourceViews);
+    context->CSSetUnorderedAccessViews(0, 2, views, nullptr);
+    context->CSSetConstantBuffers(0, 1, &constantBuffer);
+
+    hr = RunPass(context, constants, 3);
+
+    ID3D11ShaderResourceView* nullViews[2] = { nullptr, nullptr };
+    ID3D11UnorderedAccessView* nullUavs[2] = { nullptr, nullptr };
+    context->CSSetShaderResources(0, 2, nullViews);
+    context->CSSetUnorderedAccessViews(0, 2, nullUavs, nullptr);
+    context->CSSetShader(nullptr, nullptr, 0);
+    return hr;
+}
+
+HRESULT GpuColorMatcher::ReadTileScan(ID3D11DeviceContext* context, int tileCount, std::vector<UINT>& tileBits) {
+    if (!shader || tileCount < 0 || static_cast<UINT>(tileCount) > MAX_TILES) {
+        return E_INVALIDARG;
+    }
+
+    UINT words = (tileCount + 31) / 32;
+    D3D11_BOX box = { 0, 0, 0, words * 4, 1, 1 };
+    context->CopySubresourceRegion(tileReadbackBuffer, 0, 0, 0, 0, tileBuffer, 0, &box);
+
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    HRESULT hr = context->Map(tileReadbackBuffer, 0, D3D11_MAP_READ, 0, &mapped);
+    if (FAILED(hr)) {
+        return hr;
+    }
+    const UINT* bits = static_cast<const UINT*>(mapped.pData);
+    tileBits.assign(bits, bits + words);
+    context->Unmap(tileReadbackBuffer, 0);
+    return S_OK;
+}
+
+void GpuColorMatcher::ReleaseSourceView() {
+    if (sourceView) sourceView->Release();
+    sourceView = nullptr;
+    viewSource = nullptr;
+}
+
+void GpuColorMatcher::CleanUp() {
+    ReleaseSourceView();
+    if (tileReadbackBuffer) tileReadbackBuffer->Release();
+    if (tileView) tileView->Release();
+    if (tileBuffer) tileBuffer->Release();
+    if (srgbView) srgbView->Release();
+    if (srgbBuffer) srgbBuffer->Release();
+    if (readbackBuffer) readbackBuffer->Release();
+    if (resultView) resultView->Release();
+    if (resultBuffer) resultBuffer->Release();
+    if (constantBuffer) constantBuffer->Release();
+    if (shader) shader->Release();
+    if (device) device->Release();
+
+    tileReadbackBuffer = nullptr;
+    tileView = nullptr;
+    tileBuffer = nullptr;
+    srgbView = nullptr;
+    srgbBuffer = nullptr;
+    readbackBuffer = nullptr;
+    resultView = nullptr;
+    resultBuffer = nullptr;
+    constantBuffer = nullptr;
+    shader = nullptr;
+    device = nullptr;
+}
+
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <d3d11.h>
+#include <vector>
+#include "ColorMatch.h"
+
+// Runs the color match and the closest-to-center reduction on the GPU, reading back only
+// the winning pixel instead of the whole region.
+class GpuColorMatcher {
+public:
+    static const UINT MAX_TARGETS = 64;
+    static const UINT MAX_TILES = 65536;
+
+    GpuColorMatcher();
+    ~GpuColorMatcher();
+
+    HRESULT Initialize(ID3D11Device* device);
+    bool IsInitialized() const;
+
+    // Queues the match over the width x height box at (left, top) of source. The source is
+    // only read by the queued GPU work, so the caller can release the frame right after.
+    HRESULT Submit(ID3D11DeviceContext* context, ID3D11Texture2D* source,
+        UINT left, UINT top, int width, int height, const MatchTable& table, bool findClosest);
+    // Waits for the last submitted match and returns its coordinates, or -1 for no match
+    HRESULT ReadResult(ID3D11DeviceContext* context, int& foundX, int& foundY);
+
+    // Coarse pass: flags every tileSize x tileSize tile of a box holding at least one match, so
+    // only those tiles need to be copied back and scanned. BeginTileScan clears the flags, each
+    // SubmitTileScan flags the tiles of one box (row-major, from bit firstTile on) and
+    // ReadTileScan waits for them and returns the first tileCount bits.
+    HRESULT BeginTileScan(ID3D11DeviceContext* context);
+    HRESULT SubmitTileScan(ID3D11DeviceContext* context, ID3D11Texture2D* source,
+        UINT left, UINT top, int width, int height, const MatchTable& table, int tileSize, UINT firstTile);
+    HRESULT ReadTileScan(ID3D11DeviceContext* context, int tileCount, std::vector<UINT>& tileBits);
+    // Drops the cached view of the last source, which holds a reference to that texture. Call it
+    // when the duplication that owns the source surfaces is released.
+    void ReleaseSourceView();
+    void CleanUp();
+
+private:
+    struct MatchConstants {
+        UINT originX, originY;
+        UINT sizeX, sizeY;
+        INT centerX, centerY;
+        UINT targetCount;
+        UINT threshold;
+        UINT pass;
+        UINT encoding;
+        UINT tileSize;
+        UINT tilesPerRow;
+        UINT firstTile;
+        UINT metric;
+        UINT padding[2];
+        UINT targets[MAX_TARGETS][4];
+        INT targetHsv[MAX_TARGETS][4];
+    };
+
+    HRESULT BindSource(ID3D11Texture2D* source);
+    void FillConstants(MatchConstants& constants, UINT left, UINT top, int width, int height, const MatchTable& table);
+    HRESULT RunPass(ID3D11DeviceContext* context, MatchConstants& constants, UINT pass);
+
+    ID3D11Device* device;
+    ID3D11ComputeShader* shader;
+    ID3D11Buffer* constantBuffer;
+    ID3D11Buffer* resultBuffer;
+    ID3D11UnorderedAccessView* resultView;
+    ID3D11Buffer* readbackBuffer;
+    int resultWidth;      // Width of the last submitted box, 0 when nothing is pending
+    bool resultEmpty;     // Last submitted match could not find anything (no targets)
+
+    ID3D11Buffer* tileBuffer;  // MAX_TILES bits, one per tile of the coarse pass
+    ID3D11UnorderedAccessView* tileView;
+    ID3D11Buffer* tileReadbackBuffer;
+
+    // GetHalfToSrgbTable, so scRGB sources convert exactly like on the CPU
+    ID3D11Buffer* srgbBuffer;
+    ID3D11ShaderResourceView* srgbView;
+
+    // The duplication usually hands back the same surface every frame, so the view is kept
+    // until the source texture changes or ReleaseSourceView. viewSource is only compared, the
+    // only reference to the texture is the one sourceView holds.
+    ID3D11Texture2D* viewSource;
+    ID3D11ShaderResourceView* sourceView;
+    UINT sourceEncoding;
+};
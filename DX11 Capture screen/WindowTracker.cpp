@@ -0,0 +1,140 @@
+#include "WindowTracker.h"
+
+#include <iostream>
+
+// WinEvent callbacks carry no context pointer; they run on the thread that set the hook
+static thread_local WindowTracker* threadTracker = nullptr;
+
+static std::wstring WidenUtf8(const std::string& text) {
+    if (text.empty()) {
+        return std::wstring();
+    }
+    int length = MultiByteToWideChar(CP_UTF8, 0, text.c_str(), static_cast<int>(text.size()), nullptr, 0);
+    std::wstring wide(length, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, text.c_str(), static_cast<int>(text.size()), &wide[0], length);
+    return wide;
+}
+
+WindowTracker::WindowTracker(const std::string& title, const std::string& className) :
+    title(WidenUtf8(title)), className(WidenUtf8(className)), exitEvent(CreateEventW(nullptr, TRUE, FALSE, nullptr)),
+    target(nullptr), hook(nullptr), clientArea(), clientDpi(96), hasClientArea(false), generation(0) {
+    thread = std::thread(&WindowTracker::Run, this);
+}
+
+WindowTracker::~WindowTracker() {
+    SetEvent(exitEvent);
+    thread.join();
+    CloseHandle(exitEvent);
+}
+
+UINT WindowTracker::GetGeneration() const {
+    return generation.load(std::memory_order_acquire);
+}
+
+bool WindowTracker::GetClientArea(RECT& area, UINT& dpi) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    area = clientArea;
+    dpi = clientDpi;
+    return hasClientArea;
+}
+
+void WindowTracker::Run() {
+    // Physical pixels no matter how the process was started
+    SetThreadDpiAwarenessContext(DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE_V2);
+    threadTracker = this;
+
+    for (;;) {
+        if (!target && FindTarget()) {
+            UpdateClientArea();
+        }
+
+        // Out-of-context WinEvents are delivered while this thread pumps messages
+        DWORD wait = MsgWaitForMultipleObjects(1, &exitEvent, FALSE, target ? INFINITE : 1000, QS_ALLINPUT);
+        if (wait == WAIT_OBJECT_0) {
+            break;
+        }
+        MSG message;
+        while (PeekMessageW(&message, nullptr, 0, 0, PM_REMOVE)) {
+            TranslateMessage(&message);
+            DispatchMessageW(&message);
+        }
+    }
+
+    ForgetTarget();
+    threadTracker = nullptr;
+}
+
+bool WindowTracker::FindTarget() {
+    HWND window = FindWindowW(className.empty() ? nullptr : className.c_str(), title.empty() ? nullptr : title.c_str());
+    if (!window) {
+        return false;
+    }
+
+    DWORD processId = 0;
+    DWORD threadId = GetWindowThreadProcessId(window, &processId);
+    // EVENT_OBJECT_DESTROY through EVENT_OBJECT_LOCATIONCHANGE, from the window's own thread only
+    hook = SetWinEventHook(EVENT_OBJECT_DESTROY, EVENT_OBJECT_LOCATIONCHANGE, nullptr, &WindowTracker::OnWinEvent,
+        processId, threadId, WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
+    if (!hook) {
+        std::cerr << "Failed to hook window events. Error: " << GetLastError() << std::endl;
+        return false;
+    }
+    target = window;
+    return true;
+}
+
+void WindowTracker::ForgetTarget() {
+    if (hook) {
+        UnhookWinEvent(hook);
+        hook = nullptr;
+    }
+    target = nullptr;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (hasClientArea) {
+        hasClientArea = false;
+        generation.fetch_add(1, std::memory_order_release);
+    }
+}
+
+void WindowTracker::UpdateClientArea() {
+    RECT area = {};
+    POINT origin = {};
+    bool visible = IsWindowVisible(target) && !IsIconic(target) && GetClientRect(target, &area) && ClientToScreen(target, &origin);
+    // Moving to a monitor with another scale also shows up as a location change
+    UINT dpi = visible ? GetDpiForWindow(target) : 0;
+    if (dpi == 0) {
+        dpi = 96;
+    }
+    if (visible) {
+        area.left += origin.x;
+        area.top += origin.y;
+        area.right += origin.x;
+        area.bottom += origin.y;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    bool changed = visible != hasClientArea || (visible && (area.left != clientArea.left || area.top != clientArea.top ||
+        area.right != clientArea.right || area.bottom != clientArea.bottom || dpi != clientDpi));
+    if (changed) {
+        clientArea = area;
+        clientDpi = dpi;
+        hasClientArea = visible;
+        generation.fetch_add(1, std::memory_order_release);
+    }
+}
+
+void CALLBACK WindowTracker::OnWinEvent(HWINEVENTHOOK hook, DWORD event, HWND window, LONG objectId, LONG childId,
+    DWORD eventThread, DWORD eventTime) {
+    WindowTracker* tracker = threadTracker;
+    if (!tracker || window != tracker->target || objectId != OBJID_WINDOW || childId != CHILDID_SELF) {
+        return;
+    }
+    if (event == EVENT_OBJECT_DESTROY) {
+        // Look for it again from the next timeout on
+        tracker->ForgetTarget();
+    }
+    else if (event == EVENT_OBJECT_LOCATIONCHANGE || event == EVENT_OBJECT_SHOW || event == EVENT_OBJECT_HIDE) {
+        tracker->UpdateClientArea();
+    }
+}
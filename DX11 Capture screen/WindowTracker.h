@@ -0,0 +1,46 @@
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Follows the client area of a top-level window, found by title and/or class name. A background
+// thread listens for the window's move, resize and destroy WinEvents, so nothing is polled per
+// frame; while the window doesn't exist it looks for it once a second. Coordinates are physical
+// desktop pixels, the same space as DXGI_OUTPUT_DESC::DesktopCoordinates.
+class WindowTracker {
+public:
+    WindowTracker(const std::string& title, const std::string& className);
+    ~WindowTracker();
+
+    // Changes every time the client area moves, resizes, appears or disappears
+    UINT GetGeneration() const;
+    // Client area in desktop coordinates and the window's DPI. False while the window doesn't
+    // exist or is minimized.
+    bool GetClientArea(RECT& area, UINT& dpi) const;
+
+private:
+    void Run();
+    bool FindTarget();
+    void ForgetTarget();
+    void UpdateClientArea();
+    static void CALLBACK OnWinEvent(HWINEVENTHOOK hook, DWORD event, HWND window, LONG objectId, LONG childId,
+        DWORD eventThread, DWORD eventTime);
+
+    std::wstring title;      // Empty = any title
+    std::wstring className;  // Empty = any class
+    HANDLE exitEvent;
+    std::thread thread;
+
+    // Tracker thread only
+    HWND target;
+    HWINEVENTHOOK hook;
+
+    mutable std::mutex mutex;
+    RECT clientArea;
+    UINT clientDpi;
+    bool hasClientArea;
+    std::atomic<UINT> generation;
+};
@@ -3,15 +3,1089 @@
 #include <chrono>
 #include <d3d11.h>
 #include <dxgi1_2.h>
+#include <dxgi1_5.h>
 #include <Windows.h>
+#include <avrt.h>
+#include <timeapi.h>
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include <array>
 #include <vector>
 #include <cmath>
+#include <climits>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <intrin.h>
+
+#include "ColorMatch.h"
+#include "FrameRecording.h"
+#include "GpuColorMatcher.h"
+#include "WindowTracker.h"
 
 #pragma comment(lib, "d3d11.lib")
 #pragma comment(lib, "dxgi.lib")
+#pragma comment(lib, "avrt.lib")
+#pragma comment(lib, "winmm.lib")
+
+// Where one region sits in the staging atlas and how it is scanned
+struct AtlasRegion {
+    std::string name;
+    int resultSlot;  // Index of the region's ResultSlot
+    UINT atlasX;   // Column of the region's first pixel in the atlas
+    int width;
+    int height;
+    int originX;   // Screen position of the region's pixel (0, 0)
+    int originY;
+    int firstTile; // Index of the region's first coarse scan tile
+    std::shared_ptr<const ScanSettings> settings;
+    bool masksPointer;  // The mouse pointer is painted over with pointerFill before the scan
+    UINT pointerFill;   // BGRA pixel none of the region's targets match
+};
+
+// All regions packed side by side into one staging texture, so a frame needs one Map no matter
+// how many regions there are. Immutable once built; queued frames keep the layout they were
+// copied with.
+struct AtlasLayout {
+    std::vector<AtlasRegion> regions;
+    UINT width;
+    UINT height;
+    DXGI_FORMAT format;  // Of the staging atlas; the desktop's can change before it's recreated
+    int tileSize;   // Side of the coarse scan tiles, 0 = regions are copied and scanned whole
+    int tileCount;  // Coarse scan tiles of all regions
+};
+
+// Scans region index of an atlas copy. With coarse tiles only the tiles flagged in tileBits were
+// copied, and only those are read.
+static bool ScanAtlasRegion(const AtlasLayout& layout, size_t index, const BYTE* data, UINT pitch,
+    const std::vector<UINT>& tileBits, TrackingState& tracking, std::vector<BYTE>& mask, std::vector<MatchBlob>& blobs,
+    int& foundX, int& foundY, MatchBlob& blob) {
+    const AtlasRegion& region = layout.regions[index];
+    if (layout.tileSize > 0) {
+        blob = MatchBlob();
+        return FindMatchInTiles(*region.settings, data + region.atlasX * 4, pitch, region.width, region.height,
+            layout.tileSize, tileBits.data(), region.firstTile, mask, foundX, foundY);
+    }
+    return ScanRegion(*region.settings, tracking, data + region.atlasX * 4, pitch, region.width, region.height,
+        mask, blobs, foundX, foundY, blob);
+}
+
+// The pixels of a pointer shape that show on screen, 1 each. Built only when DXGI hands out a new
+// shape; copies in flight keep the shape they were taken with.
+struct PointerShape {
+    int width;
+    int height;
+    std::vector<BYTE> opaque;
+};
+
+// The pointer over one copied frame, along with that frame's capture boxes. No shape = none
+// of the pointer was inside a region that masks it.
+struct PointerOverlay {
+    std::shared_ptr<const PointerShape> shape;
+    int x;  // Desktop image position of the shape's pixel (0, 0)
+    int y;
+    std::vector<D3D11_BOX> boxes;
+};
+
+// Paints the pointer's visible pixels in a BGRA atlas with each region's pointerFill, so that no
+// scan mode (tiles, tracking, blobs, spiral) can report the pointer itself
+static void MaskPointer(const AtlasLayout& layout, const PointerOverlay& pointer, BYTE* data, UINT pitch) {
+    const PointerShape& shape = *pointer.shape;
+    for (size_t i = 0; i < layout.regions.size() && i < pointer.boxes.size(); ++i) {
+        const AtlasRegion& region = layout.regions[i];
+        if (!region.masksPointer) {
+            continue;
+        }
+        int boxLeft = static_cast<int>(pointer.boxes[i].left);
+        int boxTop = static_cast<int>(pointer.boxes[i].top);
+        int left = max(pointer.x, boxLeft);
+        int right = min(pointer.x + shape.width, boxLeft + region.width);
+        int top = max(pointer.y, boxTop);
+        int bottom = min(pointer.y + shape.height, boxTop + region.height);
+
+        for (int y = top; y < bottom; ++y) {
+            const BYTE* opaque = shape.opaque.data() + static_cast<size_t>(y - pointer.y) * shape.width;
+            UINT* row = reinterpret_cast<UINT*>(data + static_cast<size_t>(y - boxTop) * pitch) + region.atlasX;
+            for (int x = left; x < right; ++x) {
+                if (opaque[x - pointer.x]) {
+                    row[x - boxLeft] = region.pointerFill;
+                }
+            }
+        }
+    }
+}
+
+// Fixed-capacity single-producer/single-consumer ring. Slots are constructed once and reused,
+// so pushing and popping never allocates or takes a lock.
+template <typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity) : slots(capacity), head(0), tail(0) {
+    }
+
+    // Producer side: the slot to fill, or nullptr when the ring is full
+    T* BeginPush() {
+        size_t current = head.load(std::memory_order_relaxed);
+        if (current - tail.load(std::memory_order_acquire) == slots.size()) {
+            return nullptr;
+        }
+        return &slots[current % slots.size()];
+    }
+
+    void EndPush() {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Consumer side: the oldest filled slot, or nullptr when the ring is empty
+    T* BeginPop() {
+        size_t current = tail.load(std::memory_order_relaxed);
+        if (current == head.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return &slots[current % slots.size()];
+    }
+
+    void EndPop() {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    std::vector<T> slots;
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+};
+
+// Creates (or opens) the section "Local\<name>" and maps size bytes of it. Returns the view, or
+// nullptr after logging why not.
+void* MapSharedSection(const std::string& name, size_t size, HANDLE& mapping) {
+    std::wstring sectionName = L"Local\\" + std::wstring(name.begin(), name.end());
+    mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, static_cast<DWORD>(size), sectionName.c_str());
+    if (!mapping) {
+        std::cerr << "Failed to create shared section " << name << ". Error: " << GetLastError() << std::endl;
+        return nullptr;
+    }
+    void* view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (!view) {
+        std::cerr << "Failed to map shared section " << name << ". Error: " << GetLastError() << std::endl;
+        CloseHandle(mapping);
+        mapping = nullptr;
+    }
+    return view;
+}
+
+enum class MetricStage {
+    AcquireWait,  // AcquireNextFrame calls that returned a frame
+    CopySubmit,   // Queuing the region copies or the GPU match
+    MapWait,      // Map of the staging atlas, the GPU result or the coarse tile flags
+    Scan,         // CPU scan of all regions of one frame
+    EndToEnd,     // From the frame's LastPresentTime to the match being reported
+    Count,
+};
+
+static const int METRICS_BUCKETS = 32;
+static const UINT32 METRICS_MAGIC = 0x4D435844;  // "DXCM"
+static const UINT32 METRICS_VERSION = 1;
+
+// Durations in QPC ticks. Bucket i counts durations of [2^(i-1), 2^i) microseconds, bucket 0
+// everything under a microsecond.
+struct MetricsHistogram {
+    volatile LONG64 count;
+    volatile LONG64 totalTicks;
+    volatile LONG64 maxTicks;
+    volatile LONG64 buckets[METRICS_BUCKETS];
+};
+
+// Layout of the shared metrics block, plain C so any process can map and read it. Fields are
+// only ever increased, each by a single thread, so a reader needs no lock; a snapshot taken
+// while frames are recorded is off by at most those frames.
+struct MetricsBlock {
+    UINT32 magic;
+    UINT32 version;
+    LONG64 qpcFrequency;
+    volatile LONG64 lastUpdate;  // QPC time of the last recorded sample
+    volatile LONG64 framesAcquired;
+    volatile LONG64 framesUnchanged;
+    volatile LONG64 framesDropped;
+    volatile LONG64 matches;
+    MetricsHistogram stages[static_cast<int>(MetricStage::Count)];
+};
+
+// Records per-stage timings into a MetricsBlock, in a named shared memory section when one
+// could be created and in process memory otherwise.
+class CaptureMetrics {
+public:
+    CaptureMetrics();
+    ~CaptureMetrics();
+
+    // Publishes the block as "Local\<name>"; an empty name keeps it private
+    void Open(const std::string& name);
+
+    static LONG64 Now();
+    void Record(MetricStage stage, LONG64 startTicks, LONG64 endTicks);
+    void Add(volatile LONG64 MetricsBlock::* counter, LONG64 value);
+
+private:
+    void Reset();
+
+    HANDLE mapping;
+    MetricsBlock* block;
+    MetricsBlock localBlock;
+    LONG64 ticksPerMicrosecond;
+};
+
+CaptureMetrics::CaptureMetrics() : mapping(nullptr), block(&localBlock) {
+    Reset();
+}
+
+CaptureMetrics::~CaptureMetrics() {
+    if (block != &localBlock) UnmapViewOfFile(block);
+    if (mapping) CloseHandle(mapping);
+}
+
+void CaptureMetrics::Reset() {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    ticksPerMicrosecond = max(1ll, frequency.QuadPart / 1000000);
+
+    memset(block, 0, sizeof(MetricsBlock));
+    block->magic = METRICS_MAGIC;
+    block->version = METRICS_VERSION;
+    block->qpcFrequency = frequency.QuadPart;
+}
+
+void CaptureMetrics::Open(const std::string& name) {
+    if (name.empty() || mapping) {
+        return;
+    }
+
+    void* view = MapSharedSection(name, sizeof(MetricsBlock), mapping);
+    if (!view) {
+        return;
+    }
+
+    block = static_cast<MetricsBlock*>(view);
+    Reset();
+}
+
+LONG64 CaptureMetrics::Now() {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+void CaptureMetrics::Record(MetricStage stage, LONG64 startTicks, LONG64 endTicks) {
+    MetricsHistogram& histogram = block->stages[static_cast<int>(stage)];
+    LONG64 ticks = max(0ll, endTicks - startTicks);
+
+    // Bucket n > 0 holds [2^(n-1), 2^n) microseconds. _BitScanReverse64 is x64 only, so the
+    // halves are scanned separately to keep the Win32 builds working.
+    unsigned long long microseconds = static_cast<unsigned long long>(ticks / ticksPerMicrosecond);
+    unsigned long bucket = 0;
+    unsigned long highestBit;
+    if (_BitScanReverse(&highestBit, static_cast<unsigned long>(microseconds >> 32))) {
+        bucket = highestBit + 33;
+    }
+    else if (_BitScanReverse(&highestBit, static_cast<unsigned long>(microseconds))) {
+        bucket = highestBit + 1;
+    }
+    bucket = min(bucket, static_cast<unsigned long>(METRICS_BUCKETS - 1));
+
+    InterlockedExchangeAdd64(&histogram.buckets[bucket], 1);
+    InterlockedExchangeAdd64(&histogram.totalTicks, ticks);
+    // The capture and analysis threads both record some stages, so the max is raised with a
+    // compare-exchange rather than a plain store that could lose the larger sample
+    LONG64 maxTicks = histogram.maxTicks;
+    while (ticks > maxTicks) {
+        LONG64 seen = InterlockedCompareExchange64(&histogram.maxTicks, ticks, maxTicks);
+        if (seen == maxTicks) {
+            break;
+        }
+        maxTicks = seen;
+    }
+    InterlockedExchangeAdd64(&histogram.count, 1);
+    InterlockedExchange64(&block->lastUpdate, endTicks);
+}
+
+void CaptureMetrics::Add(volatile LONG64 MetricsBlock::* counter, LONG64 value) {
+    InterlockedExchangeAdd64(&(block->*counter), value);
+}
+
+static const int MAX_RESULT_SLOTS = 64;
+static const UINT32 RESULTS_MAGIC = 0x52435844;  // "DXCR"
+static const UINT32 RESULTS_VERSION = 3;
+
+// Latest match of one region. sequence is odd while the slot is being written; readers copy
+// the slot and retry when sequence was odd or changed during the copy.
+struct ResultSlot {
+    volatile LONG64 sequence;
+    LONG64 presentTime;  // QPC LastPresentTime of the frame the match was found in, 0 if unknown
+    LONG64 reportTime;   // QPC time the match was published
+    LONG x;              // Desktop coordinates of the match, the blob's centroid with blob detection
+    LONG y;
+    LONG blobArea;       // Pixels in the matched blob, 0 without blob detection
+    LONG blobLeft;       // Desktop coordinates of the blob's bounding box, inclusive
+    LONG blobTop;
+    LONG blobRight;
+    LONG blobBottom;
+    LONG padding;
+    char region[32];     // Region name, empty for the unnamed default region
+};
+
+// Where one region sits in the shared texture and on the desktop
+struct TextureRegion {
+    LONG atlasX;    // Column of the region's first pixel in the texture, its rows start at 0
+    LONG width;
+    LONG height;
+    LONG desktopX;  // Desktop coordinates of the region's pixel (0, 0)
+    LONG desktopY;
+    LONG padding;
+};
+
+// The latest frame in the shared texture (shared_texture_name). Written under the texture's
+// keyed mutex, so a consumer holding the mutex reads the state of what it sees; the sequence
+// works like ResultSlot's for readers that don't take the mutex.
+struct TextureInfo {
+    volatile LONG64 sequence;
+    LONG64 frames;       // Frames copied into the texture, 0 = none yet
+    LONG64 presentTime;  // QPC LastPresentTime of the latest one
+    LONG generation;     // Changes whenever the texture is recreated; reopen it by name then
+    LONG regionCount;
+    TextureRegion regions[MAX_RESULT_SLOTS];
+};
+
+// Layout of the shared result block, slot i belongs to region i of the capture
+struct ResultBlock {
+    UINT32 magic;
+    UINT32 version;
+    volatile LONG regionCount;
+    LONG padding;
+    LONG64 qpcFrequency;
+    ResultSlot slots[MAX_RESULT_SLOTS];
+    TextureInfo texture;
+};
+
+// Publishes matches to a ResultBlock without ever blocking the publishing thread on a reader,
+// in a named shared memory section when one could be created and in process memory otherwise.
+class ResultPublisher {
+public:
+    ResultPublisher();
+    ~ResultPublisher();
+
+    // Publishes the block as "Local\<name>"; an empty name keeps it private
+    void Open(const std::string& name);
+
+    void SetRegionCount(int count);
+    int GetRegionCount() const;
+    // blob is in desktop coordinates like x and y; its area is 0 for single-pixel matches
+    void Publish(int slot, const std::string& region, LONG x, LONG y, const MatchBlob& blob,
+        LONG64 presentTime, LONG64 reportTime);
+    // Copies a consistent snapshot of slot
+    void Read(int slot, ResultSlot& snapshot) const;
+    // Describes the frame just copied into the shared texture
+    void PublishTexture(LONG generation, LONG64 frames, LONG64 presentTime, const std::vector<TextureRegion>& regions);
+
+private:
+    HANDLE mapping;
+    ResultBlock* block;
+    std::unique_ptr<ResultBlock> localBlock;
+};
+
+ResultPublisher::ResultPublisher() : mapping(nullptr), localBlock(new ResultBlock()) {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+
+    block = localBlock.get();
+    block->magic = RESULTS_MAGIC;
+    block->version = RESULTS_VERSION;
+    block->qpcFrequency = frequency.QuadPart;
+}
+
+ResultPublisher::~ResultPublisher() {
+    if (block != localBlock.get()) UnmapViewOfFile(block);
+    if (mapping) CloseHandle(mapping);
+}
+
+void ResultPublisher::Open(const std::string& name) {
+    if (name.empty() || mapping) {
+        return;
+    }
+
+    void* view = MapSharedSection(name, sizeof(ResultBlock), mapping);
+    if (!view) {
+        return;
+    }
+
+    memcpy(view, block, sizeof(ResultBlock));
+    block = static_cast<ResultBlock*>(view);
+}
+
+void ResultPublisher::SetRegionCount(int count) {
+    block->regionCount = min(count, MAX_RESULT_SLOTS);
+}
+
+int ResultPublisher::GetRegionCount() const {
+    return block->regionCount;
+}
+
+void ResultPublisher::Publish(int slot, const std::string& region, LONG x, LONG y, const MatchBlob& blob,
+    LONG64 presentTime, LONG64 reportTime) {
+    if (slot < 0 || slot >= MAX_RESULT_SLOTS) {
+        return;
+    }
+    ResultSlot& result = block->slots[slot];
+
+    // Each frame is reported by one thread, but a pipelined capture with the GPU matcher reports
+    // its read-back frames from the capture thread and its fallback frames from the analysis
+    // thread, so writers still take the slot with a compare-exchange
+    LONG64 sequence;
+    do {
+        sequence = result.sequence;
+    } while ((sequence & 1) || InterlockedCompareExchange64(&result.sequence, sequence + 1, sequence) != sequence);
+
+    result.presentTime = presentTime;
+    result.reportTime = reportTime;
+    result.x = x;
+    result.y = y;
+    result.blobArea = blob.area;
+    result.blobLeft = blob.left;
+    result.blobTop = blob.top;
+    result.blobRight = blob.right;
+    result.blobBottom = blob.bottom;
+    size_t length = min(region.size(), sizeof(result.region) - 1);
+    memcpy(result.region, region.data(), length);
+    result.region[length] = '\0';
+
+    InterlockedExchange64(&result.sequence, sequence + 2);
+}
+
+void ResultPublisher::Read(int slot, ResultSlot& snapshot) const {
+    const ResultSlot& result = block->slots[slot];
+    for (;;) {
+        LONG64 sequence = result.sequence;
+        if (sequence & 1) {
+            YieldProcessor();
+            continue;
+        }
+        MemoryBarrier();
+        memcpy(&snapshot, const_cast<const ResultSlot*>(&result), sizeof(snapshot));
+        MemoryBarrier();
+        if (result.sequence == sequence) {
+            snapshot.sequence = sequence;
+            return;
+        }
+    }
+}
+
+void ResultPublisher::PublishTexture(LONG generation, LONG64 frames, LONG64 presentTime,
+    const std::vector<TextureRegion>& regions) {
+    TextureInfo& texture = block->texture;
+    LONG64 sequence = texture.sequence;
+    InterlockedExchange64(&texture.sequence, sequence + 1);
+
+    texture.frames = frames;
+    texture.presentTime = presentTime;
+    texture.generation = generation;
+    texture.regionCount = static_cast<LONG>(min(regions.size(), static_cast<size_t>(MAX_RESULT_SLOTS)));
+    memcpy(texture.regions, regions.data(), texture.regionCount * sizeof(TextureRegion));
+
+    InterlockedExchange64(&texture.sequence, sequence + 2);
+}
+
+// Tile size FramePacer falls back to when coarse_tile_size isn't set
+static const int PACED_COARSE_TILE_SIZE = 16;
+
+// How far FramePacer has backed off to stay within the frame budget, cheapest first
+enum class PaceLevel {
+    Full,      // Every due frame, as configured
+    HalfRate,  // Half the analysis rate
+    Coarse,    // Also coarse GPU tiles, when the scan settings allow them
+    Shrunk,    // Also regions at 3/4 of their size
+};
+
+// Limits analyses to a target rate and keeps the work per analyzed frame within a budget.
+// The capture thread sleeps until the next analysis is due instead of taking every frame;
+// DXGI accumulates the frames and their dirty rects meanwhile. The schedule follows the
+// LastPresentTime of the analyzed frames, so it stays in step with what the monitored
+// application presents.
+class FramePacer {
+public:
+    FramePacer();
+    ~FramePacer();
+
+    // 0 = analyze every frame / no budget. Restarts from PaceLevel::Full.
+    void Configure(int analysisRate, int budgetUs);
+    bool IsEnabled() const;
+    PaceLevel GetLevel() const;
+
+    // Blocks until the next analysis is due, or returns right away
+    void WaitForNextFrame();
+    // One analyzed frame: its LastPresentTime (0 = not known) and the time the capture spent
+    // copying and scanning it, in QPC ticks. Returns true when the level changed.
+    bool FrameAnalyzed(LONG64 presentTime, LONG64 costTicks);
+
+private:
+    LONG64 frequency;
+    LONG64 period;        // Ticks between analyses at the configured rate, 0 = every frame
+    LONG64 budget;        // Ticks per analyzed frame, 0 = no budget
+    LONG64 nextDue;       // QPC time the next analysis is due, 0 = now
+    LONG64 lastPresent;
+    LONG64 framePeriod;   // Moving average of the time between presents
+    LONG64 averageCost;   // Moving average of costTicks
+    int overBudgetFrames;
+    int underBudgetFrames;
+    PaceLevel level;
+    HANDLE timer;
+};
+
+FramePacer::FramePacer() : period(0), budget(0), nextDue(0), lastPresent(0), framePeriod(0), averageCost(0),
+    overBudgetFrames(0), underBudgetFrames(0), level(PaceLevel::Full) {
+    LARGE_INTEGER qpcFrequency;
+    QueryPerformanceFrequency(&qpcFrequency);
+    frequency = qpcFrequency.QuadPart;
+
+    // The plain timer rounds up to the 15.6 ms tick on older systems, this one doesn't
+    timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (!timer) {
+        timer = CreateWaitableTimerW(nullptr, TRUE, nullptr);
+    }
+}
+
+FramePacer::~FramePacer() {
+    if (timer) CloseHandle(timer);
+}
+
+void FramePacer::Configure(int analysisRate, int budgetUs) {
+    period = analysisRate > 0 ? frequency / analysisRate : 0;
+    budget = budgetUs > 0 ? budgetUs * frequency / 1000000 : 0;
+    nextDue = 0;
+    averageCost = 0;
+    overBudgetFrames = 0;
+    underBudgetFrames = 0;
+    level = PaceLevel::Full;
+}
+
+bool FramePacer::IsEnabled() const {
+    return period > 0 || budget > 0;
+}
+
+PaceLevel FramePacer::GetLevel() const {
+    return level;
+}
+
+void FramePacer::WaitForNextFrame() {
+    if (nextDue == 0) {
+        return;
+    }
+    LONG64 remaining = nextDue - CaptureMetrics::Now();
+    if (remaining <= 0) {
+        return;
+    }
+
+    // Relative due times are negative, in 100 ns units
+    LARGE_INTEGER dueTime;
+    dueTime.QuadPart = -(remaining * 10000000 / frequency);
+    if (timer && SetWaitableTimer(timer, &dueTime, 0, nullptr, nullptr, FALSE)) {
+        WaitForSingleObject(timer, INFINITE);
+    }
+    else {
+        Sleep(static_cast<DWORD>(remaining * 1000 / frequency));
+    }
+}
+
+bool FramePacer::FrameAnalyzed(LONG64 presentTime, LONG64 costTicks) {
+    LONG64 now = CaptureMetrics::Now();
+    if (presentTime != 0) {
+        if (lastPresent != 0 && presentTime > lastPresent) {
+            LONG64 interval = presentTime - lastPresent;
+            framePeriod = framePeriod ? framePeriod + (interval - framePeriod) / 8 : interval;
+        }
+        lastPresent = presentTime;
+    }
+
+    // Half rate without a configured rate means every other presented frame
+    LONG64 wait = period;
+    if (level >= PaceLevel::HalfRate) {
+        wait = period > 0 ? period * 2 : framePeriod * 2;
+    }
+    // Frames presented long ago (a static screen) aren't a reference for the next one
+    LONG64 reference = presentTime != 0 && now - presentTime < wait ? presentTime : now;
+    nextDue = wait > 0 ? reference + wait : 0;
+
+    if (budget == 0) {
+        return false;
+    }
+    averageCost = averageCost ? averageCost + (costTicks - averageCost) / 8 : costTicks;
+
+    // Back off after half a second's worth of frames over budget, recover only after a lot
+    // more frames well under it, so the level doesn't flap
+    const int BACK_OFF_FRAMES = 30;
+    const int RECOVER_FRAMES = 300;
+    PaceLevel previous = level;
+    if (averageCost > budget) {
+        underBudgetFrames = 0;
+        if (++overBudgetFrames >= BACK_OFF_FRAMES && level < PaceLevel::Shrunk) {
+            level = static_cast<PaceLevel>(static_cast<int>(level) + 1);
+            overBudgetFrames = 0;
+        }
+    }
+    else if (averageCost < budget / 2) {
+        overBudgetFrames = 0;
+        if (++underBudgetFrames >= RECOVER_FRAMES && level > PaceLevel::Full) {
+            level = static_cast<PaceLevel>(static_cast<int>(level) - 1);
+            underBudgetFrames = 0;
+        }
+    }
+    else {
+        overBudgetFrames = 0;
+        underBudgetFrames = 0;
+    }
+    return level != previous;
+}
+
+// A named area of the screen with its own target colors and tolerance. All regions are
+// analyzed from the same acquired frame.
+struct CaptureRegion {
+    std::string name;
+    std::vector<COLORREF> targetColors;
+    int tolerance;
+    int width;
+    int height;
+    int x;  // Center of the region, -1 = center of the screen
+    int y;
+};
+
+inline bool operator==(const CaptureRegion& a, const CaptureRegion& b) {
+    return a.name == b.name && a.targetColors == b.targetColors && a.tolerance == b.tolerance &&
+        a.width == b.width && a.height == b.height && a.x == b.x && a.y == b.y;
+}
+
+inline bool operator!=(const CaptureRegion& a, const CaptureRegion& b) {
+    return !(a == b);
+}
+
+// One output to duplicate, by adapter index and output index on that adapter
+struct OutputSelection {
+    UINT adapter;
+    UINT output;
+};
+
+// Everything about what we look for and where. Changes are picked up between frames, and the
+// derived match tables and staging texture are only rebuilt when the relevant fields change.
+struct CaptureConfig {
+    CaptureConfig();
+
+    std::vector<COLORREF> targetColors;
+    int tolerance;
+    int regionWidth;
+    int regionHeight;
+    int regionX;  // Center of the region, -1 = center of the screen (or of the window)
+    int regionY;
+    // When either is set, region positions are relative to this window's client area, which is
+    // followed as it moves, instead of to the output
+    std::string windowTitle;
+    std::string windowClass;
+    bool windowDpiScaling;   // Region sizes and positions are in 96 DPI pixels, scaled to the window's DPI
+    bool findClosest;
+    bool useGpuMatcher;
+    bool useLutMatcher;
+    MatchMetric metric;      // Applies to every region
+    int hueTolerance;        // Degrees, HsvRange only
+    ScanOrder scanOrder;
+    UINT acquireTimeoutMs;
+    bool lowLatencyAcquire;  // Block in AcquireNextFrame only, no sleeps or retry limit on timeouts
+    int stagingCount;        // 1 = copy and map in the same frame, N > 1 = results lag up to N - 1 frames
+    bool pipelined;          // Scan on a separate analysis thread; read once when capture starts
+    int pipelineDepth;       // Frames that can wait for the analysis thread before new ones are dropped
+    int scanThreads;         // Threads sharing one row-major CPU scan, 0 = one per core
+    int trackingWindow;      // Scan a window this wide around the last match first, 0 = always scan everything
+    int minBlobArea;         // Report connected blobs of at least this many pixels instead of single pixels, 0 = off
+    int coarseTileSize;      // Flag tiles with matches on the GPU and copy back only those, 0 = copy whole regions
+    int analysisRate;        // Analyses per second at most, 0 = every frame
+    int frameBudgetUs;       // Back off while the work per analyzed frame goes over this, 0 = no budget
+    bool maskPointer;        // Paint the mouse pointer out of the regions before the CPU scan
+
+    bool nativeFormat;       // Duplicate in the desktop's own format (HDR/10-bit) and convert per pixel
+    std::string metricsName; // Shared memory section for CaptureMetrics, empty = private; read at startup
+    std::string resultsName; // Shared memory section for the latest match per region; read at startup
+    std::string sharedTextureName;  // Keyed-mutex NT handle texture with the regions' pixels, empty = none; read at startup
+
+    // Recording of the scanned regions to a ring file for later replay; read at startup
+    std::string recordPath;  // Empty = no recording
+    int recordSizeMb;        // Size of the ring, the oldest records are overwritten once it's full
+    bool recordMatchesOnly;  // Only frames in which some region matched
+    bool recordCompression;  // Rle and deltas against the region's previous record
+    bool consoleStats;       // Print the FPS line once per second
+    int logIntervalMs;       // Console lines per region at most every this often, 0 = no match lines; read at startup
+
+    // Scheduling, read at startup. The capture and analysis threads join the MMCSS task, each
+    // thread can be pinned to a set of cores (0 = any core).
+    std::string mmcssTask;   // "Capture", "Games", ... (a task under the MMCSS SystemProfile\Tasks key), empty = none
+    AVRT_PRIORITY mmcssPriority;
+    UINT timerResolutionMs;  // timeBeginPeriod while capturing, 0 = system default
+    DWORD_PTR captureAffinity;
+    DWORD_PTR analysisAffinity;
+    DWORD_PTR logAffinity;
+    int gpuThreadPriority;   // IDXGIDevice::SetGPUThreadPriority, -7..7, read when the device is created
+
+    // Outputs to capture, each with its own device on the output's adapter; read at startup
+    bool captureAllOutputs;
+    std::vector<OutputSelection> outputs;  // Empty = primary output
+
+    // Named regions; when empty the single unnamed region described by targetColors, tolerance
+    // and region* above is analyzed
+    std::vector<CaptureRegion> regions;
+};
+
+// The regions to analyze for config, in atlas order
+std::vector<CaptureRegion> GetCaptureRegions(const CaptureConfig& config) {
+    if (!config.regions.empty()) {
+        return config.regions;
+    }
+    CaptureRegion region = { std::string(), config.targetColors, config.tolerance,
+        config.regionWidth, config.regionHeight, config.regionX, config.regionY };
+    return std::vector<CaptureRegion>(1, region);
+}
+
+CaptureConfig::CaptureConfig() :
+    targetColors({ RGB(234, 35, 1), RGB(218, 9, 1), RGB(227, 69, 53), RGB(227, 69, 53) }),
+    tolerance(15), regionWidth(40), regionHeight(40), regionX(-1), regionY(-1),
+    windowDpiScaling(false), findClosest(true), useGpuMatcher(false), useLutMatcher(false), metric(MatchMetric::Redmean),
+    hueTolerance(10), scanOrder(ScanOrder::RowMajor),
+    acquireTimeoutMs(100), lowLatencyAcquire(false), stagingCount(1),
+    pipelined(false), pipelineDepth(4), scanThreads(1), trackingWindow(0), minBlobArea(0), coarseTileSize(0),
+    analysisRate(0), frameBudgetUs(0), maskPointer(true), nativeFormat(true),
+    metricsName("DX11CaptureMetrics"), resultsName("DX11CaptureResults"), consoleStats(true), logIntervalMs(100),
+    mmcssPriority(AVRT_PRIORITY_NORMAL), timerResolutionMs(0), captureAffinity(0), analysisAffinity(0), logAffinity(0),
+    gpuThreadPriority(0), recordSizeMb(256), recordMatchesOnly(true), recordCompression(true),
+    captureAllOutputs(false) {
+}
+
+static std::string TrimConfigValue(const std::string& value) {
+    size_t first = value.find_first_not_of(" \t\r\n");
+    if (first == std::string::npos) {
+        return std::string();
+    }
+    size_t last = value.find_last_not_of(" \t\r\n");
+    return value.substr(first, last - first + 1);
+}
+
+static bool ParseConfigBool(const std::string& value) {
+    return value == "1" || value == "true" || value == "yes" || value == "on";
+}
+
+// Parses "r,g,b; r,g,b; ..." and returns false on the first malformed color
+static bool ParseConfigColors(const std::string& value, std::vector<COLORREF>& colors) {
+    colors.clear();
+    std::stringstream list(value);
+    std::string color;
+    while (std::getline(list, color, ';')) {
+        int r, g, b;
+        if (TrimConfigValue(color).empty()) {
+            continue;
+        }
+        if (sscanf_s(color.c_str(), " %d , %d , %d", &r, &g, &b) != 3) {
+            return false;
+        }
+        colors.push_back(RGB(r, g, b));
+    }
+    return true;
+}
+
+// Reads "key = value" lines on top of the values already in config. Lines starting with '#'
+// are comments. Recognized keys:
+//   colors        = r,g,b; r,g,b; ...
+//   tolerance     = 15
+//   region_width  = 40
+//   region_height = 40
+//   region_x      = -1        (-1 = screen center)
+//   region_y      = -1
+//   window_title  = Notepad   (empty = regions relative to the output)
+//   window_class  = Notepad
+//   window_dpi_scaling  = 0   (1 = region sizes/positions in 96 DPI pixels of the window)
+//   find_closest  = 1
+//   gpu_matcher   = 0
+//   lut_matcher   = 0
+//   metric        = redmean | euclidean | hsv   (hsv: tolerance applies to saturation and value, 0..255)
+//   hue_tolerance = 10        (degrees, hsv only)
+//   scan_order    = row | spiral
+//   acquire_timeout_ms  = 100
+//   low_latency_acquire = 0
+//   staging_buffers     = 1   (1..8)
+//   pipelined           = 0
+//   pipeline_depth      = 4   (1..64)
+//   scan_threads        = 1   (0 = one per core)
+//   tracking_window     = 0   (0 = off; CPU scan only)
+//   min_blob_area       = 0   (0 = single pixels; CPU scan only, no tracking)
+//   coarse_tile_size    = 0   (0 = off; pixel scans without tracking only)
+//   analysis_rate       = 0   (analyses per second, 0 = every frame)
+//   frame_budget_us     = 0   (0 = no budget; over it: half rate, then coarse tiles, then smaller regions)
+//   mask_pointer        = 1   (pointer pixels never match; frames with the pointer over a region skip the GPU matcher)
+//   native_format       = 1   (read when the duplication is created)
+//   metrics_name        = DX11CaptureMetrics   (empty = no shared metrics)
+//   results_name        = DX11CaptureResults   (empty = no shared results)
+//   shared_texture_name = DX11CaptureTexture   (empty = no shared texture)
+//   record_path         = capture.dxr          (empty = no recording)
+//   record_size_mb      = 256 (1..4095)
+//   record_matches_only = 1
+//   record_compression  = 1
+//   console_stats       = 1
+//   log_interval_ms     = 100 (0 = don't print matches)
+//   mmcss_task          = Games   (empty = no MMCSS; usually Capture or Games)
+//   mmcss_priority      = normal | low | high | critical
+//   timer_resolution_ms = 0   (0 = system default)
+//   capture_affinity    = 0x4 (core mask of the capture thread, 0 = any core)
+//   analysis_affinity   = 0   (pipelined analysis thread)
+//   log_affinity        = 0   (console log thread)
+//   gpu_thread_priority = 0   (-7..7)
+//   outputs             = primary | all | adapter:output, adapter:output, ...
+// A "[region <name>]" line starts a named region. It begins with the colors, tolerance and
+// region size/position set so far, and the colors, tolerance and region_* keys that follow
+// apply to it until the next section. Regions in the file replace any set before.
+bool LoadCaptureConfig(const std::string& path, CaptureConfig& config) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Failed to open config file " << path << std::endl;
+        return false;
+    }
+
+    CaptureConfig loaded = config;
+    loaded.regions.clear();
+    CaptureRegion* region = nullptr;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        ++lineNumber;
+        line = TrimConfigValue(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        if (line[0] == '[') {
+            std::string section = line.back() == ']' ? TrimConfigValue(line.substr(1, line.size() - 2)) : std::string();
+            if (section.compare(0, 7, "region ") != 0 || TrimConfigValue(section.substr(7)).empty()) {
+                std::cerr << path << ":" << lineNumber << ": expected [region <name>]" << std::endl;
+                return false;
+            }
+            CaptureRegion added = { TrimConfigValue(section.substr(7)), loaded.targetColors, loaded.tolerance,
+                loaded.regionWidth, loaded.regionHeight, loaded.regionX, loaded.regionY };
+            loaded.regions.push_back(added);
+            region = &loaded.regions.back();
+            continue;
+        }
+
+        size_t separator = line.find('=');
+        if (separator == std::string::npos) {
+            std::cerr << path << ":" << lineNumber << ": expected key = value" << std::endl;
+            return false;
+        }
+        std::string key = TrimConfigValue(line.substr(0, separator));
+        std::string value = TrimConfigValue(line.substr(separator + 1));
+
+        try {
+            if (region) {
+                if (key == "colors") {
+                    if (!ParseConfigColors(value, region->targetColors)) throw std::invalid_argument(value);
+                }
+                else if (key == "tolerance") region->tolerance = std::stoi(value);
+                else if (key == "region_width") region->width = std::stoi(value);
+                else if (key == "region_height") region->height = std::stoi(value);
+                else if (key == "region_x") region->x = std::stoi(value);
+                else if (key == "region_y") region->y = std::stoi(value);
+                else {
+                    std::cerr << path << ":" << lineNumber << ": '" << key << "' is not a region setting" << std::endl;
+                    return false;
+                }
+            }
+            else if (key == "colors") {
+                if (!ParseConfigColors(value, loaded.targetColors)) throw std::invalid_argument(value);
+            }
+            else if (key == "tolerance") loaded.tolerance = std::stoi(value);
+            else if (key == "region_width") loaded.regionWidth = std::stoi(value);
+            else if (key == "region_height") loaded.regionHeight = std::stoi(value);
+            else if (key == "region_x") loaded.regionX = std::stoi(value);
+            else if (key == "region_y") loaded.regionY = std::stoi(value);
+            else if (key == "window_title") loaded.windowTitle = value;
+            else if (key == "window_class") loaded.windowClass = value;
+            else if (key == "window_dpi_scaling") loaded.windowDpiScaling = ParseConfigBool(value);
+            else if (key == "find_closest") loaded.findClosest = ParseConfigBool(value);
+            else if (key == "gpu_matcher") loaded.useGpuMatcher = ParseConfigBool(value);
+            else if (key == "lut_matcher") loaded.useLutMatcher = ParseConfigBool(value);
+            else if (key == "metric") {
+                if (value == "redmean") loaded.metric = MatchMetric::Redmean;
+                else if (value == "euclidean") loaded.metric = MatchMetric::Euclidean;
+                else if (value == "hsv") loaded.metric = MatchMetric::HsvRange;
+                else throw std::invalid_argument(value);
+            }
+            else if (key == "hue_tolerance") loaded.hueTolerance = std::stoi(value);
+            else if (key == "scan_order") {
+                if (value == "row") loaded.scanOrder = ScanOrder::RowMajor;
+                else if (value == "spiral") loaded.scanOrder = ScanOrder::Spiral;
+                else throw std::invalid_argument(value);
+            }
+            else if (key == "acquire_timeout_ms") loaded.acquireTimeoutMs = static_cast<UINT>(std::stoul(value));
+            else if (key == "low_latency_acquire") loaded.lowLatencyAcquire = ParseConfigBool(value);
+            else if (key == "staging_buffers") loaded.stagingCount = std::stoi(value);
+            else if (key == "pipelined") loaded.pipelined = ParseConfigBool(value);
+            else if (key == "pipeline_depth") loaded.pipelineDepth = std::stoi(value);
+            else if (key == "scan_threads") loaded.scanThreads = std::stoi(value);
+            else if (key == "tracking_window") loaded.trackingWindow = std::stoi(value);
+            else if (key == "min_blob_area") loaded.minBlobArea = std::stoi(value);
+            else if (key == "coarse_tile_size") loaded.coarseTileSize = std::stoi(value);
+            else if (key == "mmcss_task") loaded.mmcssTask = value;
+            else if (key == "mmcss_priority") {
+                if (value == "low") loaded.mmcssPriority = AVRT_PRIORITY_LOW;
+                else if (value == "normal") loaded.mmcssPriority = AVRT_PRIORITY_NORMAL;
+                else if (value == "high") loaded.mmcssPriority = AVRT_PRIORITY_HIGH;
+                else if (value == "critical") loaded.mmcssPriority = AVRT_PRIORITY_CRITICAL;
+                else throw std::invalid_argument(value);
+            }
+            else if (key == "timer_resolution_ms") loaded.timerResolutionMs = std::stoul(value);
+            else if (key == "capture_affinity") loaded.captureAffinity = static_cast<DWORD_PTR>(std::stoull(value, nullptr, 0));
+            else if (key == "analysis_affinity") loaded.analysisAffinity = static_cast<DWORD_PTR>(std::stoull(value, nullptr, 0));
+            else if (key == "log_affinity") loaded.logAffinity = static_cast<DWORD_PTR>(std::stoull(value, nullptr, 0));
+            else if (key == "gpu_thread_priority") loaded.gpuThreadPriority = std::stoi(value);
+            else if (key == "analysis_rate") loaded.analysisRate = std::stoi(value);
+            else if (key == "frame_budget_us") loaded.frameBudgetUs = std::stoi(value);
+            else if (key == "mask_pointer") loaded.maskPointer = ParseConfigBool(value);
+            else if (key == "native_format") loaded.nativeFormat = ParseConfigBool(value);
+            else if (key == "metrics_name") loaded.metricsName = value;
+            else if (key == "results_name") loaded.resultsName = value;
+            else if (key == "shared_texture_name") loaded.sharedTextureName = value;
+            else if (key == "record_path") loaded.recordPath = value;
+            else if (key == "record_size_mb") loaded.recordSizeMb = std::stoi(value);
+            else if (key == "record_matches_only") loaded.recordMatchesOnly = ParseConfigBool(value);
+            else if (key == "record_compression") loaded.recordCompression = ParseConfigBool(value);
+            else if (key == "console_stats") loaded.consoleStats = ParseConfigBool(value);
+            else if (key == "log_interval_ms") loaded.logIntervalMs = std::stoi(value);
+            else if (key == "outputs") {
+                loaded.captureAllOutputs = value == "all";
+                loaded.outputs.clear();
+                if (value != "all" && value != "primary") {
+                    std::stringstream list(value);
+                    std::string entry;
+                    while (std::getline(list, entry, ',')) {
+                        OutputSelection selection;
+                        if (sscanf_s(entry.c_str(), " %u : %u", &selection.adapter, &selection.output) != 2) {
+                            throw std::invalid_argument(entry);
+                        }
+                        loaded.outputs.push_back(selection);
+                    }
+                }
+            }
+            else {
+                std::cerr << path << ":" << lineNumber << ": unknown key '" << key << "'" << std::endl;
+            }
+        }
+        catch (const std::exception&) {
+            std::cerr << path << ":" << lineNumber << ": invalid value for '" << key << "'" << std::endl;
+            return false;
+        }
+    }
+
+    if (loaded.regionWidth < 1 || loaded.regionHeight < 1) {
+        std::cerr << path << ": region size must be positive" << std::endl;
+        return false;
+    }
+    for (const auto& added : loaded.regions) {
+        if (added.width < 1 || added.height < 1) {
+            std::cerr << path << ": size of region '" << added.name << "' must be positive" << std::endl;
+            return false;
+        }
+    }
+    if (loaded.stagingCount < 1 || loaded.stagingCount > 8) {
+        std::cerr << path << ": staging_buffers must be between 1 and 8" << std::endl;
+        return false;
+    }
+    if (loaded.pipelineDepth < 1 || loaded.pipelineDepth > 64) {
+        std::cerr << path << ": pipeline_depth must be between 1 and 64" << std::endl;
+        return false;
+    }
+    if (loaded.logIntervalMs < 0) {
+        std::cerr << path << ": log_interval_ms can't be negative" << std::endl;
+        return false;
+    }
+    if (loaded.scanThreads < 0 || loaded.scanThreads > 64) {
+        std::cerr << path << ": scan_threads must be between 0 and 64" << std::endl;
+        return false;
+    }
+    if (loaded.hueTolerance < 0 || loaded.hueTolerance > 180) {
+        std::cerr << path << ": hue_tolerance must be between 0 and 180" << std::endl;
+        return false;
+    }
+    if (loaded.trackingWindow < 0) {
+        std::cerr << path << ": tracking_window can't be negative" << std::endl;
+        return false;
+    }
+    if (loaded.minBlobArea < 0) {
+        std::cerr << path << ": min_blob_area can't be negative" << std::endl;
+        return false;
+    }
+    if (loaded.coarseTileSize < 0 || loaded.coarseTileSize > 1024) {
+        std::cerr << path << ": coarse_tile_size must be between 0 and 1024" << std::endl;
+        return false;
+    }
+    if (loaded.analysisRate < 0 || loaded.analysisRate > 1000) {
+        std::cerr << path << ": analysis_rate must be between 0 and 1000" << std::endl;
+        return false;
+    }
+    if (loaded.frameBudgetUs < 0) {
+        std::cerr << path << ": frame_budget_us can't be negative" << std::endl;
+        return false;
+    }
+    if (loaded.recordSizeMb < 1 || loaded.recordSizeMb > 4095) {
+        std::cerr << path << ": record_size_mb must be between 1 and 4095" << std::endl;
+        return false;
+    }
+    if (loaded.gpuThreadPriority < -7 || loaded.gpuThreadPriority > 7) {
+        std::cerr << path << ": gpu_thread_priority must be between -7 and 7" << std::endl;
+        return false;
+    }
+
+    config = loaded;
+    return true;
+}
+
+// An output attached to the desktop, found by EnumerateDesktopOutputs
+struct DesktopOutput {
+    OutputSelection selection;
+    RECT desktopCoordinates;
+};
+
+// Lists the outputs attached to the desktop on every adapter. Each output only shows up
+// under the adapter that drives it.
+std::vector<DesktopOutput> EnumerateDesktopOutputs() {
+    std::vector<DesktopOutput> found;
+
+    IDXGIFactory1* factory = nullptr;
+    HRESULT hr = CreateDXGIFactory1(__uuidof(IDXGIFactory1), reinterpret_cast<void**>(&factory));
+    if (FAILED(hr)) {
+        std::cerr << "Failed to create DXGI factory. HRESULT: " << std::hex << hr << std::endl;
+        return found;
+    }
+
+    IDXGIAdapter1* adapter = nullptr;
+    for (UINT adapterIndex = 0; SUCCEEDED(factory->EnumAdapters1(adapterIndex, &adapter)); ++adapterIndex) {
+        IDXGIOutput* output = nullptr;
+        for (UINT outputIndex = 0; SUCCEEDED(adapter->EnumOutputs(outputIndex, &output)); ++outputIndex) {
+            DXGI_OUTPUT_DESC desc;
+            if (SUCCEEDED(output->GetDesc(&desc)) && desc.AttachedToDesktop) {
+                DesktopOutput entry = { { adapterIndex, outputIndex }, desc.DesktopCoordinates };
+                found.push_back(entry);
+            }
+            output->Release();
+        }
+        adapter->Release();
+    }
+
+    factory->Release();
+    return found;
+}
 
 class DX11 {
 public:
@@ -19,60 +1093,208 @@ public:
     ~DX11();
 
     HRESULT Initialize();
+    // Captures output outputIndex of adapter adapterIndex, with the device created on that
+    // adapter so frames never cross GPUs
+    HRESULT Initialize(UINT adapterIndex, UINT outputIndex);
     void CaptureAndAnalyze();
+    void RequestExit();
+
+    // Prefix for console output, to tell several captures apart
+    void SetName(const std::string& newName);
+
+    // Configuration; safe to call between frames, applied before the next one
+    void SetConfig(const CaptureConfig& newConfig);
+    const CaptureConfig& GetConfig() const;
+    void SetTargetColors(const std::vector<COLORREF>& colors);
+    void SetTolerance(int newTolerance);
+    void SetRegion(int x, int y, int width, int height);
+    void SetRegions(const std::vector<CaptureRegion>& regions);
+    void SetGpuMatcherEnabled(bool enabled);
+    void SetLutMatcherEnabled(bool enabled);
+
+    // Loads the config file and, if watch is set, reloads it whenever it changes on disk
+    bool LoadConfigFile(const std::string& path, bool watch);
+    // Reloads the config file whenever it changes on disk, without loading it now
+    void WatchConfigFile(const std::string& path);
 
 private:
     struct PixelLocation {
         int x;
         int y;
+        MatchBlob blob;  // Area 0 unless blob detection is on
     };
 
-    HRESULT AnalyzeScreenRegion();
+    // An atlas copy handed from the capture thread to the analysis thread
+    struct PendingFrame {
+        std::vector<BYTE> pixels;
+        UINT pitch;
+        LONG64 presentTime;  // LastPresentTime of the frame the copy was taken from
+        std::shared_ptr<const AtlasLayout> layout;
+        std::vector<UINT> tileBits;  // Coarse tiles that were copied, when the layout has tiles
+        POINT desktopOrigin;         // Desktop position of the output when the copy was taken
+    };
+
+    // A scanned atlas handed to RecordWorker
+    struct PendingRecord {
+        std::vector<BYTE> pixels;  // BGRA, rows of layout->width pixels
+        LONG64 presentTime;
+        LONG64 captureTime;        // QPC time of the scan
+        std::shared_ptr<const AtlasLayout> layout;
+        std::vector<PixelLocation> locations;
+        LONG desktopLeft;          // Desktop position of the captured output
+        LONG desktopTop;
+    };
+
+    HRESULT SubmitRegionCopy();
+    HRESULT AnalyzeRegionCopy(bool wait);
+    void ReleaseDesktopFrame();
+    HRESULT SubmitStagingCopy();
+    HRESULT CopyCandidateTiles(ID3D11Texture2D* texture, std::vector<UINT>& tileBits);
+    HRESULT AnalyzeStagingCopy(bool wait);
+    void QueueFrameForAnalysis(const BYTE* data, UINT rowPitch, LONG64 presentTime, const std::vector<UINT>& tileBits,
+        const PointerOverlay& pointer);
+    void AnalysisWorker();
+    void QueueFrameForRecording(const std::shared_ptr<const AtlasLayout>& layout, const BYTE* data, UINT pitch,
+        LONG64 presentTime, const std::vector<PixelLocation>& locations, POINT desktopOrigin);
+    void RecordWorker();
+    void ResultLogWorker(DWORD intervalMs);
+    void ReportMatch(const AtlasRegion& region, const PixelLocation& location, LONG64 presentTime, POINT desktopOrigin);
+    void ReportFoundLocations();
+    POINT GetDesktopOrigin() const;
+    void RunCaptureLoop();
+    void UpdateCaptureBoxes();
+    bool CaptureRegionsChanged();
+    void UpdatePointer();
+    bool PointerOverCaptureBoxes() const;
     void CleanUp();
-    double ColorDistance(BYTE r1, BYTE g1, BYTE b1, BYTE r2, BYTE g2, BYTE b2);
+    HRESULT ApplyConfig();
+    void CheckConfigFile();
+    HRESULT CreateStagingTextures();
+    void ReleaseStagingTextures();
+    HRESULT CreateSharedTexture();
+    void ReleaseSharedTexture();
+    HRESULT CopyToSharedTexture();
+    HRESULT CreateDevice();
+    bool CheckDeviceLost(HRESULT hr);
+    bool RecoverDevice();
+    void WaitBeforeRecoveryAttempt();
+    void ReleaseDeviceResources();
+    HRESULT OpenOutput();
     HRESULT ReinitializeDesktopDuplication();
+    bool RecoverDesktopDuplication();
 
     ID3D11Device* device;
     ID3D11DeviceContext* context;
     IDXGIOutputDuplication* desktopDupl;
-    ID3D11Texture2D* stagingTexture;
+    IDXGIOutput1* duplicatedOutput;
+    int recoveryAttempts;  // Failed attempts to recreate device or desktopDupl since it was lost
+    UINT adapterIndex;
+    UINT outputIndex;
+    DXGI_OUTPUT_DESC outputDesc;
+    DXGI_FORMAT desktopFormat;          // Format of the duplicated frames, the staging atlas follows it in ApplyConfig
+    std::vector<BYTE> convertedAtlas;   // BGRA8 copy of the mapped atlas for other formats
+    std::string name;
+    // Ring of staging atlases so the copy of one frame can overlap the scan of the previous one
+    std::vector<ID3D11Texture2D*> stagingTextures;
     D3D11_TEXTURE2D_DESC stagingDesc;
+    int stagingWriteIndex;
+    int stagingPending;  // Copies submitted but not scanned yet, oldest at stagingWriteIndex - stagingPending
+    std::vector<LONG64> stagingPresentTimes;  // LastPresentTime of the frame copied into each slot
+    std::vector<std::vector<UINT>> stagingTileBits;  // Coarse tiles copied into each slot
+    std::vector<PointerOverlay> stagingPointers;     // Pointer to mask in each slot
 
-    int regionWidth;
-    int regionHeight;
-    int regionX;
-    int regionY;
+    // The regions of every analyzed frame for other GPU consumers, laid out like the atlas
+    std::string sharedTextureName;  // With the capture's suffix, empty = no shared texture
+    ID3D11Texture2D* sharedTexture;
+    IDXGIKeyedMutex* sharedMutex;
+    HANDLE sharedHandle;
+    LONG sharedGeneration;
+    LONG64 sharedFrames;
+    std::vector<TextureRegion> sharedRegions;
+
+    std::chrono::time_point<std::chrono::high_resolution_clock> startTime;
+    int frameCount;
+    std::atomic<bool> shouldExit;
+
+    IDXGIResource* desktopResource;
+    ID3D11Texture2D* desktopTexture;
+    DXGI_OUTDUPL_FRAME_INFO frameInfo;
+
+    // config is what was requested, activeConfig what the current tables were built from
+    CaptureConfig config;
+    CaptureConfig activeConfig;
+    bool configDirty;
+    bool configApplied;
+    std::string configPath;
+    FILETIME configWriteTime;
+    std::chrono::time_point<std::chrono::high_resolution_clock> lastConfigCheck;
+
+    // Follows the window regions are placed in, if any; a new generation makes the config dirty
+    std::unique_ptr<WindowTracker> windowTracker;
+    UINT windowGeneration;
+
+    std::shared_ptr<const AtlasLayout> atlasLayout;
+    std::vector<D3D11_BOX> captureBoxes;        // Source box of each region in the current frame
+    std::shared_ptr<ScanThreadPool> scanPool;
+    std::vector<BYTE> matchMask;
+    std::vector<PixelLocation> foundLocations;  // Per region, -1 for no match
+    LONG64 foundPresentTime;                    // LastPresentTime of the frame foundLocations came from
+    std::vector<TrackingState> trackingStates;  // Per region, for scans on the capture thread
+    std::vector<MatchBlob> matchBlobs;
+
+    // foundLocations stay valid for frames that don't touch any capture box
+    bool hasAnalysis;
+    std::vector<BYTE> frameMetadata;
+    int unchangedFrameCount;
+
+    GpuColorMatcher gpuMatcher;
+    bool gpuResultPending;
+    bool gpuResultRead;                         // foundLocations[0] was read back from gpuMatcher this frame
+    LONG64 gpuPresentTime;
+
+    // The mouse pointer as of the latest frame. DXGI only sends a shape when it changes.
+    std::shared_ptr<const PointerShape> pointerShape;  // Null until the duplication sends one
+    std::vector<BYTE> pointerShapeBuffer;
+    bool pointerVisible;
+    POINT pointerPosition;
+    bool pointerMasked;  // The latest copy had pointer pixels masked out, so they were never scanned
+
+    CaptureMetrics metrics;
+
+    // analysis_rate and frame_budget_us; its level feeds into ApplyConfig
+    FramePacer pacer;
+    std::atomic<LONG64> workerScanTicks;  // Scan time of the last frame on the analysis thread
 
-    std::chrono::time_point<std::chrono::high_resolution_clock> startTime;
-    int frameCount;
-    std::atomic<bool> shouldExit;
+    // Matches go to the result block; ResultLogWorker prints them from there, rate limited
+    ResultPublisher results;
+    HANDLE logExitEvent;
 
-    IDXGIResource* desktopResource;
-    ID3D11Texture2D* desktopTexture;
-    DXGI_OUTDUPL_FRAME_INFO frameInfo;
+    // Pipelined mode: the capture thread fills frameQueue, AnalysisWorker drains it
+    std::unique_ptr<SpscRing<PendingFrame>> frameQueue;
+    HANDLE frameQueuedEvent;
+    std::atomic<bool> analysisExit;
+    std::atomic<int> droppedFrameCount;
 
-    std::vector<COLORREF> TARGET_COLORS;
-    int tolerance;
-    PixelLocation foundLocation;
+    // Recording: whichever thread scans fills recordQueue, RecordWorker compresses and writes
+    RecordingWriter recorder;
+    bool recordMatchesOnly;
+    bool recordCompression;
+    std::unique_ptr<SpscRing<PendingRecord>> recordQueue;
+    HANDLE recordQueuedEvent;
+    std::atomic<bool> recordExit;
+    std::atomic<int> droppedRecordCount;
 };
 
-double DX11::ColorDistance(BYTE r1, BYTE g1, BYTE b1, BYTE r2, BYTE g2, BYTE b2) {
-    double rmean = (r1 + r2) / 2.0;
-    int r = r1 - r2;
-    int g = g1 - g2;
-    int b = b1 - b2;
-    double weightR = 2 + rmean / 256.0;
-    double weightG = 4.0;
-    double weightB = 2 + (255 - rmean) / 256.0;
-    return std::sqrt(weightR * r * r + weightG * g * g + weightB * b * b);
-}
-
 DX11::DX11() :
-    device(nullptr), context(nullptr), desktopDupl(nullptr), stagingTexture(nullptr),
-    desktopResource(nullptr), desktopTexture(nullptr),
-    regionWidth(40), regionHeight(40), frameCount(0), shouldExit(false) {
-    regionX = GetSystemMetrics(SM_CXSCREEN) / 2;
-    regionY = GetSystemMetrics(SM_CYSCREEN) / 2;
+    device(nullptr), context(nullptr), desktopDupl(nullptr), duplicatedOutput(nullptr), recoveryAttempts(0), adapterIndex(0), outputIndex(0), outputDesc(), desktopFormat(DXGI_FORMAT_B8G8R8A8_UNORM), stagingDesc(), stagingWriteIndex(0), stagingPending(0),
+    sharedTexture(nullptr), sharedMutex(nullptr), sharedHandle(nullptr), sharedGeneration(0), sharedFrames(0),
+    desktopResource(nullptr), desktopTexture(nullptr), frameCount(0), shouldExit(false),
+    configDirty(true), configApplied(false), configWriteTime(), windowGeneration(0),
+    foundPresentTime(0), hasAnalysis(false), unchangedFrameCount(0), gpuResultPending(false), gpuResultRead(false), gpuPresentTime(0),
+    pointerVisible(false), pointerPosition(), pointerMasked(false),
+    workerScanTicks(0),
+    logExitEvent(nullptr), frameQueuedEvent(nullptr), analysisExit(false), droppedFrameCount(0),
+    recordMatchesOnly(true), recordCompression(true), recordQueuedEvent(nullptr), recordExit(false), droppedRecordCount(0) {
 }
 
 DX11::~DX11() {
@@ -80,27 +1302,170 @@ DX11::~DX11() {
 }
 
 HRESULT DX11::Initialize() {
+    return Initialize(0, 0);
+}
+
+// Every D3D call for a capture is made on its capture thread (the analysis thread and the scan
+// pool only touch CPU copies), so the device can skip its locking, and the driver is asked not
+// to spread work over threads of its own, which only adds latency to a copy this small.
+static const UINT DEVICE_CREATION_FLAGS = D3D11_CREATE_DEVICE_SINGLETHREADED | D3D11_CREATE_DEVICE_BGRA_SUPPORT |
+    D3D11_CREATE_DEVICE_PREVENT_INTERNAL_THREADING_OPTIMIZATIONS;
+
+// Creates the device on adapter adapterIndex. A fresh factory is used each time, since the old
+// one goes stale when the device was removed by a driver update.
+HRESULT DX11::CreateDevice() {
     HRESULT hr;
 
-    // Create D3D11 device
+    IDXGIFactory1* factory = nullptr;
+    hr = CreateDXGIFactory1(__uuidof(IDXGIFactory1), reinterpret_cast<void**>(&factory));
+    if (FAILED(hr)) {
+        std::cerr << "Failed to create DXGI factory. HRESULT: " << std::hex << hr << std::endl;
+        return hr;
+    }
+
+    IDXGIAdapter1* adapter = nullptr;
+    hr = factory->EnumAdapters1(adapterIndex, &adapter);
+    factory->Release();
+    if (FAILED(hr)) {
+        std::cerr << "Failed to get DXGI adapter " << adapterIndex << ". HRESULT: " << std::hex << hr << std::endl;
+        return hr;
+    }
+
+    // Create D3D11 device on the adapter that drives the output
     D3D_FEATURE_LEVEL featureLevel;
-    hr = D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_HARDWARE, nullptr, 0, nullptr, 0, D3D11_SDK_VERSION, &device, &featureLevel, &context);
+    hr = D3D11CreateDevice(adapter, D3D_DRIVER_TYPE_UNKNOWN, nullptr, DEVICE_CREATION_FLAGS, nullptr, 0, D3D11_SDK_VERSION,
+        &device, &featureLevel, &context);
+    adapter->Release();
     if (FAILED(hr)) {
         std::cerr << "Failed to create D3D11 device. HRESULT: " << std::hex << hr << std::endl;
         return hr;
     }
 
+    // Lets the copies jump ahead of the monitored application's rendering on a busy GPU
+    if (config.gpuThreadPriority != 0) {
+        IDXGIDevice* dxgiDevice = nullptr;
+        hr = device->QueryInterface(__uuidof(IDXGIDevice), reinterpret_cast<void**>(&dxgiDevice));
+        if (SUCCEEDED(hr)) {
+            hr = dxgiDevice->SetGPUThreadPriority(config.gpuThreadPriority);
+            dxgiDevice->Release();
+        }
+        if (FAILED(hr)) {
+            std::cerr << "Failed to set GPU thread priority. HRESULT: " << std::hex << hr << std::endl;
+        }
+    }
+
+    return S_OK;
+}
+
+inline bool IsDeviceLostError(HRESULT hr) {
+    return hr == DXGI_ERROR_DEVICE_REMOVED || hr == DXGI_ERROR_DEVICE_RESET || hr == DXGI_ERROR_DEVICE_HUNG ||
+        hr == DXGI_ERROR_DRIVER_INTERNAL_ERROR;
+}
+
+// Checks a failed call for a lost device and, if so, drops the device and everything created
+// from it. The capture loop then rebuilds them before the next frame.
+bool DX11::CheckDeviceLost(HRESULT hr) {
+    if (!device) {
+        return true;
+    }
+    HRESULT reason = device->GetDeviceRemovedReason();
+    if (!IsDeviceLostError(hr) && SUCCEEDED(reason)) {
+        return false;
+    }
+
+    std::cerr << "D3D11 device lost. HRESULT: 0x" << std::hex << hr << ", reason: 0x" << reason << std::dec << std::endl;
+    ReleaseDeviceResources();
+    context->Release();
+    context = nullptr;
+    device->Release();
+    device = nullptr;
+    return true;
+}
+
+// Recreates the device and the duplication after CheckDeviceLost; the staging atlas and the
+// GPU matcher follow through ApplyConfig. Match tables are CPU side and stay as they are.
+bool DX11::RecoverDevice() {
+    WaitBeforeRecoveryAttempt();
+
+    HRESULT hr = CreateDevice();
+    if (SUCCEEDED(hr)) {
+        std::cerr << "D3D11 device recreated." << std::endl;
+        configDirty = true;
+        recoveryAttempts = 0;
+        return true;
+    }
+    recoveryAttempts++;
+    return false;
+}
+
+HRESULT DX11::Initialize(UINT newAdapterIndex, UINT newOutputIndex) {
+    HRESULT hr;
+
+    adapterIndex = newAdapterIndex;
+    outputIndex = newOutputIndex;
+
+    std::string sectionSuffix = "_" + std::to_string(adapterIndex) + "_" + std::to_string(outputIndex);
+    if (!config.metricsName.empty()) {
+        metrics.Open(config.metricsName + sectionSuffix);
+    }
+    if (!config.resultsName.empty()) {
+        results.Open(config.resultsName + sectionSuffix);
+    }
+    if (!config.sharedTextureName.empty()) {
+        sharedTextureName = config.sharedTextureName + sectionSuffix;
+    }
+    if (!config.recordPath.empty()) {
+        // capture.dxr becomes capture_0_0.dxr
+        std::string recordPath = config.recordPath;
+        size_t extension = recordPath.find_last_of('.');
+        size_t directory = recordPath.find_last_of("\\/");
+        if (extension == std::string::npos || (directory != std::string::npos && extension < directory)) {
+            extension = recordPath.size();
+        }
+        recordPath.insert(extension, sectionSuffix);
+        if (recorder.Open(recordPath, static_cast<UINT64>(config.recordSizeMb) << 20)) {
+            recordMatchesOnly = config.recordMatchesOnly;
+            recordCompression = config.recordCompression;
+        }
+    }
+
+    hr = CreateDevice();
+    if (FAILED(hr)) {
+        return hr;
+    }
+
     hr = ReinitializeDesktopDuplication();
+    if (FAILED(hr)) {
+        std::cerr << "Failed to duplicate output. HRESULT: " << std::hex << hr << std::endl;
+        return hr;
+    }
+
+    hr = ApplyConfig();
     if (FAILED(hr)) {
         return hr;
     }
 
-    // Create a staging texture for the region we want to analyze
-    stagingDesc.Width = regionWidth;
-    stagingDesc.Height = regionHeight;
+    return S_OK;
+}
+
+void DX11::ReleaseStagingTextures() {
+    for (ID3D11Texture2D* texture : stagingTextures) {
+        if (texture) texture->Release();
+    }
+    stagingTextures.clear();
+    stagingWriteIndex = 0;
+    stagingPending = 0;
+}
+
+HRESULT DX11::CreateStagingTextures() {
+    ReleaseStagingTextures();
+
+    // Create staging textures holding every region we want to analyze
+    stagingDesc.Width = atlasLayout->width;
+    stagingDesc.Height = atlasLayout->height;
     stagingDesc.MipLevels = 1;
     stagingDesc.ArraySize = 1;
-    stagingDesc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+    stagingDesc.Format = atlasLayout->format;
     stagingDesc.SampleDesc.Count = 1;
     stagingDesc.SampleDesc.Quality = 0;
     stagingDesc.Usage = D3D11_USAGE_STAGING;
@@ -108,21 +1473,434 @@ HRESULT DX11::Initialize() {
     stagingDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
     stagingDesc.MiscFlags = 0;
 
-    hr = device->CreateTexture2D(&stagingDesc, nullptr, &stagingTexture);
+    for (int i = 0; i < config.stagingCount; ++i) {
+        ID3D11Texture2D* texture = nullptr;
+        HRESULT hr = device->CreateTexture2D(&stagingDesc, nullptr, &texture);
+        if (FAILED(hr)) {
+            std::cerr << "Failed to Create texture 2D " << std::endl;
+            ReleaseStagingTextures();
+            return hr;
+        }
+        stagingTextures.push_back(texture);
+    }
+    stagingPresentTimes.assign(stagingTextures.size(), 0);
+    stagingTileBits.resize(stagingTextures.size());
+    stagingPointers.assign(stagingTextures.size(), PointerOverlay());
+
+    return S_OK;
+}
+
+// Creates the shared texture for the current atlas and publishes it as "Local\<name>", for
+// consumers to open with ID3D11Device1::OpenSharedResourceByName. Consumers and the capture
+// both acquire and release the keyed mutex with key 0.
+HRESULT DX11::CreateSharedTexture() {
+    ReleaseSharedTexture();
+
+    D3D11_TEXTURE2D_DESC desc = stagingDesc;
+    desc.Usage = D3D11_USAGE_DEFAULT;
+    desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    desc.CPUAccessFlags = 0;
+    desc.MiscFlags = D3D11_RESOURCE_MISC_SHARED_NTHANDLE | D3D11_RESOURCE_MISC_SHARED_KEYEDMUTEX;
+    HRESULT hr = device->CreateTexture2D(&desc, nullptr, &sharedTexture);
+    if (FAILED(hr)) {
+        return hr;
+    }
+
+    hr = sharedTexture->QueryInterface(__uuidof(IDXGIKeyedMutex), reinterpret_cast<void**>(&sharedMutex));
+    if (SUCCEEDED(hr)) {
+        IDXGIResource1* resource = nullptr;
+        hr = sharedTexture->QueryInterface(__uuidof(IDXGIResource1), reinterpret_cast<void**>(&resource));
+        if (SUCCEEDED(hr)) {
+            std::wstring handleName = L"Local\\" + std::wstring(sharedTextureName.begin(), sharedTextureName.end());
+            hr = resource->CreateSharedHandle(nullptr, DXGI_SHARED_RESOURCE_READ | DXGI_SHARED_RESOURCE_WRITE,
+                handleName.c_str(), &sharedHandle);
+            resource->Release();
+        }
+    }
     if (FAILED(hr)) {
-        std::cerr << "Failed to Create texture 2D " << std::endl;
+        ReleaseSharedTexture();
         return hr;
     }
 
+    sharedGeneration++;
+    sharedFrames = 0;
     return S_OK;
 }
 
-HRESULT DX11::ReinitializeDesktopDuplication() {
+void DX11::ReleaseSharedTexture() {
+    if (sharedMutex) sharedMutex->Release();
+    if (sharedTexture) sharedTexture->Release();
+    if (sharedHandle) CloseHandle(sharedHandle);
+    sharedMutex = nullptr;
+    sharedTexture = nullptr;
+    sharedHandle = nullptr;
+}
+
+// Copies the regions of the acquired frame into the shared texture. The capture never waits
+// for a consumer: while one holds the mutex, frames are simply not copied for it.
+HRESULT DX11::CopyToSharedTexture() {
+    HRESULT hr = sharedMutex->AcquireSync(0, 0);
+    if (hr == static_cast<HRESULT>(WAIT_TIMEOUT)) {
+        return S_OK;
+    }
+    if (hr == static_cast<HRESULT>(WAIT_ABANDONED)) {
+        // A consumer died holding the mutex and the contents are undefined; start over with a
+        // new texture, consumers see the generation change
+        ReleaseSharedTexture();
+        configDirty = true;
+        return S_OK;
+    }
+    if (FAILED(hr)) {
+        return hr;
+    }
+
+    sharedRegions.resize(atlasLayout->regions.size());
+    for (size_t i = 0; i < atlasLayout->regions.size(); ++i) {
+        const AtlasRegion& region = atlasLayout->regions[i];
+        context->CopySubresourceRegion(sharedTexture, 0, region.atlasX, 0, 0, desktopTexture, 0, &captureBoxes[i]);
+
+        TextureRegion& described = sharedRegions[i];
+        described.atlasX = static_cast<LONG>(region.atlasX);
+        described.width = region.width;
+        described.height = region.height;
+        described.desktopX = static_cast<LONG>(captureBoxes[i].left) + outputDesc.DesktopCoordinates.left;
+        described.desktopY = static_cast<LONG>(captureBoxes[i].top) + outputDesc.DesktopCoordinates.top;
+        described.padding = 0;
+    }
+    results.PublishTexture(sharedGeneration, ++sharedFrames, frameInfo.LastPresentTime.QuadPart, sharedRegions);
+
+    return sharedMutex->ReleaseSync(0);
+}
+
+void DX11::SetConfig(const CaptureConfig& newConfig) {
+    config = newConfig;
+    configDirty = true;
+}
+
+const CaptureConfig& DX11::GetConfig() const {
+    return config;
+}
+
+void DX11::SetTargetColors(const std::vector<COLORREF>& colors) {
+    config.targetColors = colors;
+    configDirty = true;
+}
+
+void DX11::SetTolerance(int newTolerance) {
+    config.tolerance = newTolerance;
+    configDirty = true;
+}
+
+void DX11::SetRegion(int x, int y, int width, int height) {
+    config.regionX = x;
+    config.regionY = y;
+    config.regionWidth = max(1, width);
+    config.regionHeight = max(1, height);
+    configDirty = true;
+}
+
+void DX11::SetRegions(const std::vector<CaptureRegion>& regions) {
+    config.regions = regions;
+    configDirty = true;
+}
+
+void DX11::SetGpuMatcherEnabled(bool enabled) {
+    config.useGpuMatcher = enabled;
+    configDirty = true;
+}
+
+void DX11::SetLutMatcherEnabled(bool enabled) {
+    config.useLutMatcher = enabled;
+    configDirty = true;
+}
+
+static bool GetConfigWriteTime(const std::string& path, FILETIME& writeTime) {
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &attributes)) {
+        return false;
+    }
+    writeTime = attributes.ftLastWriteTime;
+    return true;
+}
+
+bool DX11::LoadConfigFile(const std::string& path, bool watch) {
+    CaptureConfig loaded = config;
+    if (!LoadCaptureConfig(path, loaded)) {
+        return false;
+    }
+    SetConfig(loaded);
+
+    if (watch) {
+        WatchConfigFile(path);
+    }
+    else {
+        configPath.clear();
+    }
+    return true;
+}
+
+void DX11::WatchConfigFile(const std::string& path) {
+    configPath = path;
+    GetConfigWriteTime(path, configWriteTime);
+    lastConfigCheck = std::chrono::high_resolution_clock::now();
+}
+
+void DX11::SetName(const std::string& newName) {
+    name = newName;
+}
+
+void DX11::RequestExit() {
+    shouldExit = true;
+}
+
+void DX11::CheckConfigFile() {
+    if (configPath.empty()) {
+        return;
+    }
+
+    // Checking the timestamp is a syscall, so only do it a couple of times per second
+    auto now = std::chrono::high_resolution_clock::now();
+    if (now - lastConfigCheck < std::chrono::milliseconds(500)) {
+        return;
+    }
+    lastConfigCheck = now;
+
+    FILETIME writeTime;
+    if (!GetConfigWriteTime(configPath, writeTime) || CompareFileTime(&writeTime, &configWriteTime) == 0) {
+        return;
+    }
+    configWriteTime = writeTime;
+
+    // Keep running with the previous settings if the new file doesn't parse
+    CaptureConfig loaded = config;
+    if (LoadCaptureConfig(configPath, loaded)) {
+        std::cout << "Reloaded config from " << configPath << std::endl;
+        SetConfig(loaded);
+    }
+}
+
+// Options that can't be honored are turned off in the applied copy only, so the requested config
+// gets them back once the conflict is gone. E_INVALIDARG means the regions don't fit the atlas
+// and the previous layout is still in place.
+HRESULT DX11::ApplyConfig() {
     HRESULT hr;
+    CaptureConfig applied = config;
 
-    if (desktopDupl) {
-        desktopDupl->Release();
-        desktopDupl = nullptr;
+    std::vector<CaptureRegion> wanted = GetCaptureRegions(applied);
+    std::vector<CaptureRegion> previous;
+    if (configApplied) {
+        previous = GetCaptureRegions(activeConfig);
+    }
+    bool scanChanged = !configApplied || applied.useLutMatcher != activeConfig.useLutMatcher ||
+        applied.scanOrder != activeConfig.scanOrder || applied.findClosest != activeConfig.findClosest ||
+        applied.scanThreads != activeConfig.scanThreads || applied.trackingWindow != activeConfig.trackingWindow ||
+        applied.minBlobArea != activeConfig.minBlobArea;
+
+    if (!configApplied || applied.scanThreads != activeConfig.scanThreads) {
+        // Frames still queued hold on to the old pool through their settings
+        int threads = applied.scanThreads > 0 ? applied.scanThreads : static_cast<int>(std::thread::hardware_concurrency());
+        scanPool = threads > 1 ? GetSharedScanPool(threads) : nullptr;
+    }
+
+    if (!configApplied || applied.analysisRate != activeConfig.analysisRate || applied.frameBudgetUs != activeConfig.frameBudgetUs) {
+        pacer.Configure(applied.analysisRate, applied.frameBudgetUs);
+    }
+
+    if (applied.coarseTileSize > 0 && (applied.trackingWindow > 0 || applied.minBlobArea > 0)) {
+        // Both need every pixel of the region, not just the flagged tiles
+        std::cerr << "Coarse tiles don't work with tracking or blobs, copying whole regions." << std::endl;
+        applied.coarseTileSize = 0;
+    }
+    if (applied.coarseTileSize > 0 && recorder.IsOpen()) {
+        // Recordings hold whole regions
+        std::cerr << "Coarse tiles don't work with recording, copying whole regions." << std::endl;
+        applied.coarseTileSize = 0;
+    }
+    // The pacer falls back to coarse tiles where the scan settings allow them
+    int coarseTileSize = applied.coarseTileSize;
+    if (coarseTileSize == 0 && pacer.GetLevel() >= PaceLevel::Coarse && applied.trackingWindow == 0 &&
+        applied.minBlobArea == 0 && !applied.useGpuMatcher && !recorder.IsOpen()) {
+        coarseTileSize = PACED_COARSE_TILE_SIZE;
+    }
+    if (coarseTileSize > 0 && !gpuMatcher.IsInitialized()) {
+        hr = gpuMatcher.Initialize(device);
+        if (FAILED(hr)) {
+            std::cerr << "Coarse tiles need the GPU matcher, copying whole regions." << std::endl;
+            gpuMatcher.CleanUp();
+            applied.coarseTileSize = 0;
+            coarseTileSize = 0;
+        }
+    }
+
+    if (!configApplied || applied.windowTitle != activeConfig.windowTitle || applied.windowClass != activeConfig.windowClass) {
+        windowTracker.reset();
+        if (!applied.windowTitle.empty() || !applied.windowClass.empty()) {
+            windowTracker.reset(new WindowTracker(applied.windowTitle, applied.windowClass));
+        }
+    }
+    // Region positions are relative to the window's client area, or else to the captured output
+    RECT placement = outputDesc.DesktopCoordinates;
+    UINT dpi = 96;
+    if (windowTracker) {
+        // Read the generation first, so a change while placing the regions applies again
+        windowGeneration = windowTracker->GetGeneration();
+        if (!windowTracker->GetClientArea(placement, dpi)) {
+            std::cerr << "Window " << (applied.windowTitle.empty() ? applied.windowClass : applied.windowTitle) <<
+                " not found or minimized, regions are relative to the output until it shows up." << std::endl;
+            placement = outputDesc.DesktopCoordinates;
+            dpi = 96;
+        }
+    }
+    float scale = windowTracker && applied.windowDpiScaling ? dpi / 96.0f : 1.0f;
+    // Shrunk regions keep their centers
+    float sizeScale = pacer.GetLevel() >= PaceLevel::Shrunk ? scale * 0.75f : scale;
+    int placementWidth = placement.right - placement.left;
+    int placementHeight = placement.bottom - placement.top;
+
+    auto layout = std::make_shared<AtlasLayout>();
+    layout->width = 0;
+    layout->height = 0;
+    layout->format = desktopFormat;
+    layout->tileSize = coarseTileSize;
+    layout->tileCount = 0;
+    for (size_t i = 0; i < wanted.size(); ++i) {
+        const CaptureRegion& region = wanted[i];
+        AtlasRegion placed;
+        placed.name = region.name;
+        placed.resultSlot = static_cast<int>(i);
+        placed.atlasX = layout->width;
+        placed.width = max(1, static_cast<int>(region.width * sizeScale + 0.5f));
+        placed.height = max(1, static_cast<int>(region.height * sizeScale + 0.5f));
+        int left = (region.x >= 0 ? static_cast<int>(region.x * scale + 0.5f) : placementWidth / 2) - placed.width / 2;
+        int top = (region.y >= 0 ? static_cast<int>(region.y * scale + 0.5f) : placementHeight / 2) - placed.height / 2;
+        if (windowTracker) {
+            // Keep the region inside the client area when it fits, instead of picking up whatever
+            // is next to the window
+            left = max(0, min(left, placementWidth - placed.width));
+            top = max(0, min(top, placementHeight - placed.height));
+        }
+        // Origins are relative to the captured output
+        placed.originX = placement.left - outputDesc.DesktopCoordinates.left + left;
+        placed.originY = placement.top - outputDesc.DesktopCoordinates.top + top;
+        placed.firstTile = layout->tileCount;
+        if (layout->tileSize > 0) {
+            layout->tileCount += ((placed.width + layout->tileSize - 1) / layout->tileSize) *
+                ((placed.height + layout->tileSize - 1) / layout->tileSize);
+        }
+
+        // Keep the old settings, or at least the old table, when nothing they depend on changed
+        const AtlasRegion* old = atlasLayout && i < previous.size() ? &atlasLayout->regions[i] : nullptr;
+        bool sameTable = old && previous[i].targetColors == region.targetColors &&
+            previous[i].tolerance == region.tolerance && applied.useLutMatcher == activeConfig.useLutMatcher &&
+            applied.metric == activeConfig.metric && applied.hueTolerance == activeConfig.hueTolerance;
+        if (sameTable && !scanChanged) {
+            placed.settings = old->settings;
+        }
+        else {
+            auto settings = std::make_shared<ScanSettings>();
+            if (sameTable) {
+                settings->table = old->settings->table;
+            }
+            else {
+                BuildMatchTable(region.targetColors, region.tolerance, applied.metric, applied.hueTolerance, settings->table);
+                if (applied.useLutMatcher) {
+                    BuildMatchLut(settings->table);
+                }
+            }
+            // Compiled for the table's metric and target count where possible
+            settings->kernel = applied.useLutMatcher ? MatchRowLut : SelectMatchRowKernel(settings->table);
+            settings->order = applied.scanOrder;
+            settings->findClosest = applied.findClosest;
+            settings->pool = scanPool;
+            settings->trackingWindow = applied.trackingWindow;
+            settings->minBlobArea = applied.minBlobArea;
+            placed.settings = settings;
+        }
+        placed.pointerFill = 0;
+        placed.masksPointer = applied.maskPointer && FindUnmatchedPixel(placed.settings->table, placed.pointerFill);
+        if (applied.maskPointer && !placed.masksPointer && !sameTable) {
+            std::cerr << "Region " << (region.name.empty() ? std::string("(default)") : region.name) <<
+                " matches every color, the pointer can't be masked out of it." << std::endl;
+        }
+
+        layout->width += placed.width;
+        layout->height = max(layout->height, static_cast<UINT>(placed.height));
+        layout->regions.push_back(placed);
+    }
+
+    if (layout->width > D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION || layout->height > D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION) {
+        std::cerr << "Regions don't fit in one " << D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION << " pixel wide staging texture." << std::endl;
+        return E_INVALIDARG;
+    }
+    if (layout->tileCount > static_cast<int>(GpuColorMatcher::MAX_TILES)) {
+        std::cerr << "Regions need more than " << GpuColorMatcher::MAX_TILES << " coarse tiles, copying whole regions." << std::endl;
+        layout->tileSize = 0;
+        layout->tileCount = 0;
+    }
+    atlasLayout = layout;
+    results.SetRegionCount(static_cast<int>(layout->regions.size()));
+    captureBoxes.assign(layout->regions.size(), D3D11_BOX());
+    foundLocations.assign(layout->regions.size(), PixelLocation({ -1, -1 }));
+    trackingStates.assign(layout->regions.size(), TrackingState());
+
+    bool atlasChanged = stagingTextures.size() != static_cast<size_t>(applied.stagingCount) ||
+        stagingDesc.Width != atlasLayout->width || stagingDesc.Height != atlasLayout->height ||
+        stagingDesc.Format != atlasLayout->format;
+    if (atlasChanged) {
+        hr = CreateStagingTextures();
+        if (FAILED(hr)) {
+            return hr;
+        }
+    }
+    if (!sharedTextureName.empty() && (atlasChanged || !sharedTexture)) {
+        hr = CreateSharedTexture();
+        if (FAILED(hr)) {
+            if (IsDeviceLostError(hr)) {
+                return hr;
+            }
+            std::cerr << "Failed to create shared texture " << sharedTextureName << ", continuing without it. HRESULT: " <<
+                std::hex << hr << std::dec << std::endl;
+            sharedTextureName.clear();
+        }
+    }
+    // Copies still in flight were taken for the old settings
+    stagingPending = 0;
+    gpuResultPending = false;
+
+    if (applied.useGpuMatcher && applied.minBlobArea > 0) {
+        // The matcher only reduces to a single pixel
+        std::cerr << "GPU matcher doesn't detect blobs, using CPU scan." << std::endl;
+        applied.useGpuMatcher = false;
+    }
+    if (applied.useGpuMatcher && atlasLayout->regions.size() > 1) {
+        // The matcher reduces a single box; several regions go through the atlas instead
+        std::cerr << "GPU matcher supports a single region, using CPU scan." << std::endl;
+        applied.useGpuMatcher = false;
+    }
+    if (applied.useGpuMatcher && !gpuMatcher.IsInitialized()) {
+        hr = gpuMatcher.Initialize(device);
+        if (FAILED(hr)) {
+            std::cerr << "GPU matcher unavailable, falling back to CPU scan." << std::endl;
+            gpuMatcher.CleanUp();
+            applied.useGpuMatcher = false;
+        }
+    }
+
+    activeConfig = applied;
+    configApplied = true;
+    configDirty = false;
+    hasAnalysis = false;
+    return S_OK;
+}
+
+// Finds the selected output on the device's adapter. The output is kept until it stops
+// accepting duplications, so recovering from ACCESS_LOST doesn't walk the DXGI tree again.
+HRESULT DX11::OpenOutput() {
+    HRESULT hr;
+
+    if (duplicatedOutput) {
+        duplicatedOutput->Release();
+        duplicatedOutput = nullptr;
     }
 
     // Get DXGI device
@@ -142,80 +1920,325 @@ HRESULT DX11::ReinitializeDesktopDuplication() {
         return hr;
     }
 
-    // Get primary output (monitor)
+    // Get the selected output (monitor)
     IDXGIOutput* dxgiOutput = nullptr;
-    hr = dxgiAdapter->EnumOutputs(0, &dxgiOutput);
+    hr = dxgiAdapter->EnumOutputs(outputIndex, &dxgiOutput);
     dxgiAdapter->Release();
     if (FAILED(hr)) {
-        std::cerr << "Failed to get DXGI output. HRESULT: " << std::hex << hr << std::endl;
+        std::cerr << "Failed to get DXGI output " << outputIndex << ". HRESULT: " << std::hex << hr << std::endl;
         return hr;
     }
 
     // QI for Output 1
-    IDXGIOutput1* dxgiOutput1 = nullptr;
-    hr = dxgiOutput->QueryInterface(__uuidof(IDXGIOutput1), reinterpret_cast<void**>(&dxgiOutput1));
+    hr = dxgiOutput->QueryInterface(__uuidof(IDXGIOutput1), reinterpret_cast<void**>(&duplicatedOutput));
     dxgiOutput->Release();
     if (FAILED(hr)) {
         std::cerr << "Failed to query IDXGIOutput1. HRESULT: " << std::hex << hr << std::endl;
         return hr;
     }
 
-    // Create desktop duplication
-    hr = dxgiOutput1->DuplicateOutput(device, &desktopDupl);
-    dxgiOutput1->Release();
-    if (FAILED(hr)) {
-        std::cerr << "Failed to duplicate output. HRESULT: " << std::hex << hr << std::endl;
-        return hr;
+    return S_OK;
+}
+
+// Creates the duplication on the cached output. Only the duplication is replaced: the device,
+// the staging atlas and the match tables stay, unless the output's size or format changed.
+HRESULT DX11::ReinitializeDesktopDuplication() {
+    HRESULT hr;
+
+    if (desktopDupl) {
+        desktopDupl->Release();
+        desktopDupl = nullptr;
+    }
+    // The matcher's cached view would keep a surface of the old duplication alive
+    gpuMatcher.ReleaseSourceView();
+    // A new duplication starts over with the pointer's position and shape
+    pointerShape = nullptr;
+    pointerVisible = false;
+
+    if (!duplicatedOutput) {
+        hr = OpenOutput();
+        if (FAILED(hr)) {
+            return hr;
+        }
+    }
+
+    DXGI_OUTPUT_DESC desc;
+    duplicatedOutput->GetDesc(&desc);
+    if (desc.DesktopCoordinates.right - desc.DesktopCoordinates.left != outputDesc.DesktopCoordinates.right - outputDesc.DesktopCoordinates.left ||
+        desc.DesktopCoordinates.bottom - desc.DesktopCoordinates.top != outputDesc.DesktopCoordinates.bottom - outputDesc.DesktopCoordinates.top) {
+        configDirty = true;  // Region centers and clamping depend on the output size
+    }
+    outputDesc = desc;
+
+    // Prefer DuplicateOutput1, which can hand out the desktop in its own format. It needs
+    // Windows 10 1703+ and a per-monitor DPI aware process; otherwise fall back to BGRA8.
+    HRESULT nativeHr = S_OK;
+    if (config.nativeFormat) {
+        IDXGIOutput5* dxgiOutput5 = nullptr;
+        nativeHr = duplicatedOutput->QueryInterface(__uuidof(IDXGIOutput5), reinterpret_cast<void**>(&dxgiOutput5));
+        if (SUCCEEDED(nativeHr)) {
+            nativeHr = dxgiOutput5->DuplicateOutput1(device, 0, ARRAYSIZE(DUPLICATION_FORMATS), DUPLICATION_FORMATS, &desktopDupl);
+            dxgiOutput5->Release();
+        }
+    }
+
+    if (!desktopDupl) {
+        // Create desktop duplication
+        hr = duplicatedOutput->DuplicateOutput(device, &desktopDupl);
+        if (FAILED(hr)) {
+            return hr;
+        }
+        if (FAILED(nativeHr)) {
+            std::cerr << "DuplicateOutput1 failed, using BGRA8 duplication. HRESULT: 0x" << std::hex << nativeHr << std::dec << std::endl;
+        }
+    }
+
+    DXGI_OUTDUPL_DESC duplDesc;
+    desktopDupl->GetDesc(&duplDesc);
+    if (duplDesc.ModeDesc.Format != desktopFormat) {
+        // A mode change (e.g. HDR toggled) can switch formats; the staging atlas has to follow
+        desktopFormat = duplDesc.ModeDesc.Format;
+        configDirty = true;
+    }
+
+    // The new duplication's first frame has no metadata relative to what we analyzed last
+    hasAnalysis = false;
+    return S_OK;
+}
+
+// The first recovery attempt runs right away; after that attempts back off from 1 ms up to
+// MAX_RECOVERY_DELAY_MS and never give up
+void DX11::WaitBeforeRecoveryAttempt() {
+    const DWORD MAX_RECOVERY_DELAY_MS = 250;
+
+    if (recoveryAttempts > 0) {
+        Sleep(min(MAX_RECOVERY_DELAY_MS, 1ul << min(recoveryAttempts - 1, 8)));
+    }
+}
+
+// Called while there is no duplication. A plain mode switch costs a single DuplicateOutput
+// call; while the desktop stays unavailable (UAC or lock screen, a fullscreen transition in
+// progress) the attempts back off.
+bool DX11::RecoverDesktopDuplication() {
+    WaitBeforeRecoveryAttempt();
+
+    HRESULT hr = ReinitializeDesktopDuplication();
+    if (SUCCEEDED(hr)) {
+        if (recoveryAttempts > 0) {
+            std::cerr << "Desktop duplication recovered after " << recoveryAttempts + 1 << " attempts." << std::endl;
+        }
+        recoveryAttempts = 0;
+        return true;
+    }
+    if (CheckDeviceLost(hr)) {
+        return false;
+    }
+
+    // These mean the desktop is temporarily unavailable, anything else that the cached output
+    // itself went away (e.g. the monitor was unplugged or the topology changed)
+    if (hr != E_ACCESSDENIED && hr != DXGI_ERROR_UNSUPPORTED && hr != DXGI_ERROR_NOT_CURRENTLY_AVAILABLE &&
+        hr != DXGI_ERROR_SESSION_DISCONNECTED && duplicatedOutput) {
+        duplicatedOutput->Release();
+        duplicatedOutput = nullptr;
+    }
+
+    // Report the first failure and then only every doubling, not every retry
+    if ((recoveryAttempts & (recoveryAttempts - 1)) == 0) {
+        std::cerr << "Failed to recreate desktop duplication (attempt " << recoveryAttempts + 1 << "). HRESULT: 0x"
+            << std::hex << hr << std::dec << std::endl;
+    }
+    recoveryAttempts++;
+    return false;
+}
+
+// Puts the calling thread of one pipeline stage on its cores and, if mmcssTask is set, into
+// that MMCSS task, so it isn't preempted by normal priority work. Returns the MMCSS handle to
+// pass to EndStageThread, or nullptr.
+static HANDLE BeginStageThread(const char* stage, DWORD_PTR affinity, const std::string& mmcssTask, AVRT_PRIORITY mmcssPriority) {
+    if (affinity != 0 && !SetThreadAffinityMask(GetCurrentThread(), affinity)) {
+        std::cerr << "Failed to pin the " << stage << " thread to cores 0x" << std::hex << affinity << std::dec <<
+            ". Error: " << GetLastError() << std::endl;
+    }
+    if (mmcssTask.empty()) {
+        return nullptr;
+    }
+
+    std::wstring task(mmcssTask.begin(), mmcssTask.end());
+    DWORD taskIndex = 0;
+    HANDLE mmcssHandle = AvSetMmThreadCharacteristicsW(task.c_str(), &taskIndex);
+    if (!mmcssHandle) {
+        std::cerr << "Failed to join MMCSS task " << mmcssTask << " for the " << stage << " thread. Error: " <<
+            GetLastError() << std::endl;
+        return nullptr;
+    }
+    if (!AvSetMmThreadPriority(mmcssHandle, mmcssPriority)) {
+        std::cerr << "Failed to set the MMCSS priority of the " << stage << " thread. Error: " << GetLastError() << std::endl;
+    }
+    return mmcssHandle;
+}
+
+static void EndStageThread(HANDLE mmcssHandle) {
+    if (mmcssHandle) {
+        AvRevertMmThreadCharacteristics(mmcssHandle);
+    }
+}
+
+void DX11::CaptureAndAnalyze() {
+    std::thread analysisThread;
+    std::thread logThread;
+
+    // Timed waits (pacing, acquire retries) wake up on time instead of on the next 15.6 ms tick
+    if (activeConfig.timerResolutionMs > 0) {
+        timeBeginPeriod(activeConfig.timerResolutionMs);
+    }
+    // Worker threads get their settings up front, activeConfig can change under them
+    std::string mmcssTask = activeConfig.mmcssTask;
+    AVRT_PRIORITY mmcssPriority = activeConfig.mmcssPriority;
+    DWORD_PTR analysisAffinity = activeConfig.analysisAffinity;
+    DWORD_PTR logAffinity = activeConfig.logAffinity;
+    HANDLE mmcssHandle = BeginStageThread("capture", activeConfig.captureAffinity, mmcssTask, mmcssPriority);
+
+    if (activeConfig.logIntervalMs > 0) {
+        logExitEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+        DWORD intervalMs = static_cast<DWORD>(activeConfig.logIntervalMs);
+        logThread = std::thread([this, intervalMs, logAffinity]() {
+            // Only pinned: console output shouldn't compete with the MMCSS threads
+            BeginStageThread("log", logAffinity, std::string(), AVRT_PRIORITY_NORMAL);
+            ResultLogWorker(intervalMs);
+        });
+    }
+
+    std::thread recordThread;
+    if (recorder.IsOpen()) {
+        // Up front, the analysis thread may record from its first frame
+        const size_t RECORD_QUEUE_DEPTH = 16;
+        recordQueue.reset(new SpscRing<PendingRecord>(RECORD_QUEUE_DEPTH));
+        recordQueuedEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+        recordExit = false;
+        recordThread = std::thread(&DX11::RecordWorker, this);
+    }
+
+    if (activeConfig.pipelined) {
+        frameQueue.reset(new SpscRing<PendingFrame>(activeConfig.pipelineDepth));
+        frameQueuedEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+        analysisExit = false;
+        analysisThread = std::thread([this, analysisAffinity, mmcssTask, mmcssPriority]() {
+            HANDLE analysisMmcss = BeginStageThread("analysis", analysisAffinity, mmcssTask, mmcssPriority);
+            AnalysisWorker();
+            EndStageThread(analysisMmcss);
+        });
+    }
+
+    RunCaptureLoop();
+
+    if (analysisThread.joinable()) {
+        analysisExit = true;
+        SetEvent(frameQueuedEvent);
+        analysisThread.join();
+        CloseHandle(frameQueuedEvent);
+        frameQueuedEvent = nullptr;
+        frameQueue.reset();
+    }
+
+    if (recordThread.joinable()) {
+        // RecordWorker writes out what is still queued before it returns
+        recordExit = true;
+        SetEvent(recordQueuedEvent);
+        recordThread.join();
+        CloseHandle(recordQueuedEvent);
+        recordQueuedEvent = nullptr;
+        recordQueue.reset();
+        recorder.Close();
+    }
+
+    if (logThread.joinable()) {
+        SetEvent(logExitEvent);
+        logThread.join();
+        CloseHandle(logExitEvent);
+        logExitEvent = nullptr;
     }
 
-    return S_OK;
+    EndStageThread(mmcssHandle);
+    if (activeConfig.timerResolutionMs > 0) {
+        timeEndPeriod(activeConfig.timerResolutionMs);
+    }
 }
 
-void DX11::CaptureAndAnalyze() {
+void DX11::RunCaptureLoop() {
     startTime = std::chrono::high_resolution_clock::now();
-    const UINT TIMEOUT_MS = 100; // 100ms timeout
     const int MAX_ATTEMPTS = 5;
 
     while (!shouldExit) {
-        TARGET_COLORS = { RGB(234, 35, 1), RGB(218, 9, 1), RGB(227, 69, 53), RGB(227, 69, 53) };
-        tolerance = 15;
+        // Device and duplication come first, the staging atlas in ApplyConfig depends on them
+        if (!device && !RecoverDevice()) {
+            continue;
+        }
+        if (!desktopDupl && !RecoverDesktopDuplication()) {
+            continue;
+        }
+
+        CheckConfigFile();
+        if (windowTracker && windowTracker->GetGeneration() != windowGeneration) {
+            configDirty = true;  // The window moved, resized, appeared or went away
+        }
+        if (configDirty) {
+            HRESULT configHr = ApplyConfig();
+            if (FAILED(configHr)) {
+                if (CheckDeviceLost(configHr)) {
+                    continue;
+                }
+                std::cerr << "Failed to apply config. HRESULT: 0x" << std::hex << configHr << std::dec << std::endl;
+                if (!configApplied || configHr != E_INVALIDARG) {
+                    return;
+                }
+                // Keep capturing with the previous layout until the config or the window changes again
+                std::cerr << "Keeping the previous config." << std::endl;
+                configDirty = false;
+            }
+        }
+
+        // At most analysis_rate frames per second; in between DXGI accumulates the updates
+        pacer.WaitForNextFrame();
 
         HRESULT hr = S_OK;
         int attempts = 0;
 
         do {
-            if (desktopResource) {
-                desktopResource->Release();
-                desktopResource = nullptr;
-            }
-
-            // Release the previous frame before acquiring a new one
-            if (desktopDupl) {
-                desktopDupl->ReleaseFrame();
+            LONG64 acquireStart = CaptureMetrics::Now();
+            hr = desktopDupl->AcquireNextFrame(activeConfig.acquireTimeoutMs, &frameInfo, &desktopResource);
+            if (SUCCEEDED(hr)) {
+                metrics.Record(MetricStage::AcquireWait, acquireStart, CaptureMetrics::Now());
+                metrics.Add(&MetricsBlock::framesAcquired, 1);
             }
 
-            hr = desktopDupl->AcquireNextFrame(TIMEOUT_MS, &frameInfo, &desktopResource);
-
             if (hr == DXGI_ERROR_WAIT_TIMEOUT) {
+                if (activeConfig.lowLatencyAcquire) {
+                    // Nothing changed on screen; go straight back to waiting in AcquireNextFrame
+                    break;
+                }
                 attempts++;
                 Sleep(50);
                 continue;
             }
             else if (FAILED(hr)) {
                 if (hr == DXGI_ERROR_ACCESS_LOST) {
-                    std::cerr << "Access lost. Attempting to reinitialize..." << std::endl;
-                    hr = ReinitializeDesktopDuplication();
-                    if (FAILED(hr)) {
-                        std::cerr << "Failed to reinitialize desktop duplication. HRESULT: 0x" << std::hex << hr << std::dec << std::endl;
-                        return;
-                    }
-                    attempts = 0;
-                    continue;
+                    // Mode change, desktop switch or fullscreen transition; the duplication has
+                    // to be recreated, and the top of the loop does that before applying the
+                    // config the new duplication may have dirtied (e.g. a format switch)
+                    std::cerr << "Access lost. Recreating desktop duplication..." << std::endl;
+                    desktopDupl->Release();
+                    desktopDupl = nullptr;
+                    break;
+                }
+                else if (CheckDeviceLost(hr)) {
+                    break;
                 }
                 else {
                     std::cerr << "Failed to acquire frame. HRESULT: 0x" << std::hex << hr << std::dec << std::endl;
                     attempts++;
-                    Sleep(100);
+                    if (!activeConfig.lowLatencyAcquire) {
+                        Sleep(100);
+                    }
                     continue;
                 }
             }
@@ -223,17 +2246,31 @@ void DX11::CaptureAndAnalyze() {
             break; // Successfully acquired frame
         } while (attempts < MAX_ATTEMPTS);
 
+        if (!device || !desktopDupl || (hr == DXGI_ERROR_WAIT_TIMEOUT && activeConfig.lowLatencyAcquire)) {
+            continue;
+        }
+
         if (SUCCEEDED(hr)) {
+            bool regionChanged = false;
+            LONG64 workStart = CaptureMetrics::Now();
+            UpdatePointer();
+
             hr = desktopResource->QueryInterface(__uuidof(ID3D11Texture2D), reinterpret_cast<void**>(&desktopTexture));
             if (SUCCEEDED(hr)) {
-                hr = AnalyzeScreenRegion();
-                if (FAILED(hr)) {
-                    std::cerr << "Failed to analyze screen region. HRESULT: 0x" << std::hex << hr << std::dec << std::endl;
+                UpdateCaptureBoxes();
+                regionChanged = CaptureRegionsChanged();
+                if (regionChanged) {
+                    LONG64 submitStart = CaptureMetrics::Now();
+                    hr = SubmitRegionCopy();
+                    metrics.Record(MetricStage::CopySubmit, submitStart, CaptureMetrics::Now());
+                    hasAnalysis = SUCCEEDED(hr);
+                    if (FAILED(hr)) {
+                        std::cerr << "Failed to copy screen region. HRESULT: 0x" << std::hex << hr << std::dec << std::endl;
+                    }
                 }
-                else if (foundLocation.x != -1 && foundLocation.y != -1) {
-                    std::cout << "Found matching color at: ("
-                        << foundLocation.x + (regionX - regionWidth / 2) << ", "
-                        << foundLocation.y + (regionY - regionHeight / 2) << ")" << std::endl;
+                else {
+                    unchangedFrameCount++;
+                    metrics.Add(&MetricsBlock::framesUnchanged, 1);
                 }
                 desktopTexture->Release();
                 desktopTexture = nullptr;
@@ -241,7 +2278,40 @@ void DX11::CaptureAndAnalyze() {
             else {
                 std::cerr << "Failed to query desktop texture. HRESULT: 0x" << std::hex << hr << std::dec << std::endl;
             }
-            // Note: We don't call ReleaseFrame() here anymore, as it's now called at the beginning of the loop
+
+            // Everything we need from the frame has been queued on the GPU, so give it back to
+            // DXGI now instead of holding it through the CPU scan
+            ReleaseDesktopFrame();
+
+            if (FAILED(hr)) {
+                CheckDeviceLost(hr);
+            }
+            else {
+                // Frames that didn't change the region just finish any copies still in the ring
+                hr = AnalyzeRegionCopy(!regionChanged);
+                if (FAILED(hr)) {
+                    if (!CheckDeviceLost(hr)) {
+                        std::cerr << "Failed to analyze screen region. HRESULT: 0x" << std::hex << hr << std::dec << std::endl;
+                    }
+                }
+                else if (!frameQueue || gpuResultRead) {
+                    // In pipelined mode CPU scan results, including the GPU matcher's fallback
+                    // frames, are reported by the analysis thread
+                    ReportFoundLocations();
+                }
+
+                if (regionChanged && SUCCEEDED(hr) && pacer.IsEnabled()) {
+                    // The analysis thread's scan of an earlier frame stands in for this one's
+                    LONG64 cost = CaptureMetrics::Now() - workStart + (frameQueue ? workerScanTicks.load() : 0);
+                    if (pacer.FrameAnalyzed(frameInfo.LastPresentTime.QuadPart, cost)) {
+                        static const char* const LEVEL_NAMES[] = { "full rate", "half rate", "coarse tiles", "smaller regions" };
+                        std::cout << (name.empty() ? std::string() : "[" + name + "] ") << "Frame budget: now at " <<
+                            LEVEL_NAMES[static_cast<int>(pacer.GetLevel())] << std::endl;
+                        // Coarse tiles and region sizes go through the layout
+                        configDirty = true;
+                    }
+                }
+            }
         }
         else {
             std::cerr << "Failed to acquire frame after " << MAX_ATTEMPTS << " attempts." << std::endl;
@@ -254,104 +2324,754 @@ void DX11::CaptureAndAnalyze() {
         std::chrono::duration<double> elapsedTime = currentTime - startTime;
         if (elapsedTime.count() >= 1.0) {
             double fps = frameCount / elapsedTime.count();
-            std::cout << "FPS: " << fps << std::endl;
+            std::ostringstream line;
+            if (!name.empty()) {
+                line << "[" << name << "] ";
+            }
+            line << "FPS: " << fps << " (" << unchangedFrameCount << " unchanged";
+            if (frameQueue) {
+                line << ", " << droppedFrameCount.exchange(0) << " dropped";
+            }
+            if (recordQueue) {
+                line << ", " << droppedRecordCount.exchange(0) << " not recorded";
+            }
+            line << ")" << std::endl;
+            if (activeConfig.consoleStats) {
+                std::cout << line.str();
+            }
 
             startTime = std::chrono::high_resolution_clock::now();
             frameCount = 0;
+            unchangedFrameCount = 0;
         }
     }
 }
 
-HRESULT DX11::AnalyzeScreenRegion() {
-    bool findClosest = true;
-
+void DX11::UpdateCaptureBoxes() {
     D3D11_TEXTURE2D_DESC desc;
     desktopTexture->GetDesc(&desc);
 
-    UINT captureLeft = static_cast<UINT>(max(0, min(regionX - regionWidth / 2, static_cast<int>(desc.Width - regionWidth))));
-    UINT captureTop = static_cast<UINT>(max(0, min(regionY - regionHeight / 2, static_cast<int>(desc.Height - regionHeight))));
+    for (size_t i = 0; i < atlasLayout->regions.size(); ++i) {
+        const AtlasRegion& region = atlasLayout->regions[i];
+        UINT captureLeft = static_cast<UINT>(max(0, min(region.originX, static_cast<int>(desc.Width - region.width))));
+        UINT captureTop = static_cast<UINT>(max(0, min(region.originY, static_cast<int>(desc.Height - region.height))));
+
+        D3D11_BOX box = {
+            captureLeft,
+            captureTop,
+            0,
+            captureLeft + region.width,
+            captureTop + region.height,
+            1
+        };
+        captureBoxes[i] = box;
+    }
+}
+
+// Uses the frame metadata to decide whether anything inside any capture box was redrawn since
+// the last analyzed frame. Errs on the side of analyzing when the metadata can't be read.
+bool DX11::CaptureRegionsChanged() {
+    if (!hasAnalysis) {
+        return true;
+    }
+
+    // Only the pointer moved, the desktop image is the same as last time. That is only worth a
+    // scan when the last one masked pointer pixels, which may have hidden a match.
+    if (frameInfo.LastPresentTime.QuadPart == 0 || frameInfo.AccumulatedFrames == 0) {
+        return pointerMasked && (frameInfo.LastMouseUpdateTime.QuadPart != 0 || frameInfo.PointerShapeBufferSize != 0);
+    }
+
+    if (frameInfo.TotalMetadataBufferSize == 0) {
+        return true;
+    }
+    if (frameMetadata.size() < frameInfo.TotalMetadataBufferSize) {
+        frameMetadata.resize(frameInfo.TotalMetadataBufferSize);
+    }
 
-    D3D11_BOX sourceRegion = {
-        captureLeft,
-        captureTop,
-        0,
-        captureLeft + regionWidth,
-        captureTop + regionHeight,
-        1
+    auto intersects = [this](const RECT& rect) {
+        for (const D3D11_BOX& box : captureBoxes) {
+            if (rect.left < static_cast<LONG>(box.right) && rect.right > static_cast<LONG>(box.left) &&
+                rect.top < static_cast<LONG>(box.bottom) && rect.bottom > static_cast<LONG>(box.top)) {
+                return true;
+            }
+        }
+        return false;
     };
 
-    context->CopySubresourceRegion(stagingTexture, 0, 0, 0, 0, desktopTexture, 0, &sourceRegion);
+    // Move rects have to be read before the dirty rects
+    UINT moveBytes = 0;
+    HRESULT hr = desktopDupl->GetFrameMoveRects(frameInfo.TotalMetadataBufferSize,
+        reinterpret_cast<DXGI_OUTDUPL_MOVE_RECT*>(frameMetadata.data()), &moveBytes);
+    if (FAILED(hr)) {
+        return true;
+    }
+    const DXGI_OUTDUPL_MOVE_RECT* moveRects = reinterpret_cast<const DXGI_OUTDUPL_MOVE_RECT*>(frameMetadata.data());
+    for (UINT i = 0; i < moveBytes / sizeof(DXGI_OUTDUPL_MOVE_RECT); ++i) {
+        if (intersects(moveRects[i].DestinationRect)) {
+            return true;
+        }
+    }
+
+    UINT dirtyBytes = 0;
+    hr = desktopDupl->GetFrameDirtyRects(frameInfo.TotalMetadataBufferSize - moveBytes,
+        reinterpret_cast<RECT*>(frameMetadata.data() + moveBytes), &dirtyBytes);
+    if (FAILED(hr)) {
+        return true;
+    }
+    const RECT* dirtyRects = reinterpret_cast<const RECT*>(frameMetadata.data() + moveBytes);
+    for (UINT i = 0; i < dirtyBytes / sizeof(RECT); ++i) {
+        if (intersects(dirtyRects[i])) {
+            return true;
+        }
+    }
 
-    D3D11_MAPPED_SUBRESOURCE mappedResource;
-    HRESULT hr = context->Map(stagingTexture, 0, D3D11_MAP_READ, 0, &mappedResource);
-    if (SUCCEEDED(hr)) {
-        PBYTE dataPtr = static_cast<PBYTE>(mappedResource.pData);
-
-        std::vector<PixelLocation> matchingPixels;
-        int centerX = regionWidth / 2;
-        int centerY = regionHeight / 2;
-
-        for (int y = 0; y < regionHeight; ++y) {
-            for (int x = 0; x < regionWidth; ++x) {
-                int index = y * mappedResource.RowPitch + x * 4;  // 4 bytes per pixel (BGRA)
-                BYTE blue = dataPtr[index];
-                BYTE green = dataPtr[index + 1];
-                BYTE red = dataPtr[index + 2];
-
-                for (const auto& targetColor : TARGET_COLORS) {
-                    if (ColorDistance(red, green, blue,
-                        GetRValue(targetColor),
-                        GetGValue(targetColor),
-                        GetBValue(targetColor)) <= tolerance) {
-                        matchingPixels.push_back({x, y});
-                        if (!findClosest) {
-                            // If we're not finding the closest, we can return the first (highest) match
-                            context->Unmap(stagingTexture, 0);
-                            foundLocation = {x, y};
-                            return S_OK;
-                        }
-                        break;  // No need to check other colors for this pixel
-                    }
+    return false;
+}
+
+// Takes the pointer position and, when DXGI has a new one, the pointer shape from the acquired
+// frame. Has to run before the frame is released.
+void DX11::UpdatePointer() {
+    if (frameInfo.LastMouseUpdateTime.QuadPart != 0) {
+        pointerVisible = frameInfo.PointerPosition.Visible != FALSE;
+        pointerPosition = frameInfo.PointerPosition.Position;
+    }
+    if (frameInfo.PointerShapeBufferSize == 0) {
+        return;
+    }
+
+    if (pointerShapeBuffer.size() < frameInfo.PointerShapeBufferSize) {
+        pointerShapeBuffer.resize(frameInfo.PointerShapeBufferSize);
+    }
+    UINT shapeBytes = 0;
+    DXGI_OUTDUPL_POINTER_SHAPE_INFO info;
+    HRESULT hr = desktopDupl->GetFramePointerShape(static_cast<UINT>(pointerShapeBuffer.size()), pointerShapeBuffer.data(),
+        &shapeBytes, &info);
+    if (FAILED(hr)) {
+        std::cerr << "Failed to get pointer shape. HRESULT: 0x" << std::hex << hr << std::dec << std::endl;
+        pointerShape = nullptr;
+        return;
+    }
+
+    auto shape = std::make_shared<PointerShape>();
+    shape->width = static_cast<int>(info.Width);
+    // Monochrome shapes are an AND mask followed by an XOR mask of the same size
+    shape->height = static_cast<int>(info.Type == DXGI_OUTDUPL_POINTER_SHAPE_TYPE_MONOCHROME ? info.Height / 2 : info.Height);
+    shape->opaque.assign(static_cast<size_t>(shape->width) * shape->height, 0);
+    for (int y = 0; y < shape->height; ++y) {
+        const BYTE* row = pointerShapeBuffer.data() + static_cast<size_t>(y) * info.Pitch;
+        for (int x = 0; x < shape->width; ++x) {
+            bool opaque;
+            if (info.Type == DXGI_OUTDUPL_POINTER_SHAPE_TYPE_MONOCHROME) {
+                // AND 1 with XOR 0 leaves the screen as it is; everything else replaces or inverts it
+                BYTE bit = static_cast<BYTE>(0x80 >> (x % 8));
+                bool andBit = (row[x / 8] & bit) != 0;
+                bool xorBit = (row[static_cast<size_t>(shape->height) * info.Pitch + x / 8] & bit) != 0;
+                opaque = !andBit || xorBit;
+            }
+            else {
+                UINT pixel;
+                memcpy(&pixel, row + x * 4, sizeof(pixel));
+                if (info.Type == DXGI_OUTDUPL_POINTER_SHAPE_TYPE_MASKED_COLOR) {
+                    // Alpha 0 replaces the screen pixel, alpha 0xFF XORs it with the color
+                    opaque = (pixel >> 24) == 0 || (pixel & 0xFFFFFF) != 0;
+                }
+                else {
+                    opaque = (pixel >> 24) != 0;
                 }
             }
+            shape->opaque[static_cast<size_t>(y) * shape->width + x] = opaque ? 1 : 0;
+        }
+    }
+    pointerShape = shape;
+}
+
+// Whether the visible pointer covers part of a region that masks it in the current frame
+bool DX11::PointerOverCaptureBoxes() const {
+    if (!pointerVisible || !pointerShape) {
+        return false;
+    }
+    for (size_t i = 0; i < captureBoxes.size(); ++i) {
+        const D3D11_BOX& box = captureBoxes[i];
+        if (atlasLayout->regions[i].masksPointer &&
+            pointerPosition.x < static_cast<LONG>(box.right) && pointerPosition.x + pointerShape->width > static_cast<LONG>(box.left) &&
+            pointerPosition.y < static_cast<LONG>(box.bottom) && pointerPosition.y + pointerShape->height > static_cast<LONG>(box.top)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void DX11::ReleaseDesktopFrame() {
+    if (desktopResource) {
+        desktopResource->Release();
+        desktopResource = nullptr;
+    }
+    desktopDupl->ReleaseFrame();
+}
+
+// Queues the GPU side of the analysis for the acquired frame: either the GPU matcher or the
+// copy into the staging ring
+HRESULT DX11::SubmitRegionCopy() {
+    if (sharedTexture) {
+        HRESULT hr = CopyToSharedTexture();
+        if (FAILED(hr)) {
+            return hr;
+        }
+    }
+
+    // The GPU matcher reads the desktop texture directly and can't mask the pointer, so frames
+    // with the pointer over the region go through the staging copy
+    pointerMasked = PointerOverCaptureBoxes();
+    if (activeConfig.useGpuMatcher && !pointerMasked) {
+        const AtlasRegion& region = atlasLayout->regions[0];
+        HRESULT hr = gpuMatcher.Submit(context, desktopTexture, captureBoxes[0].left, captureBoxes[0].top,
+            region.width, region.height, region.settings->table, activeConfig.findClosest);
+        if (SUCCEEDED(hr)) {
+            gpuResultPending = true;
+            gpuPresentTime = frameInfo.LastPresentTime.QuadPart;
+            return S_OK;
+        }
+        // Fall through to the CPU scan (e.g. more targets than the shader supports)
+    }
+
+    return SubmitStagingCopy();
+}
+
+// Produces foundLocations from whatever SubmitRegionCopy queued; runs after the frame is released
+HRESULT DX11::AnalyzeRegionCopy(bool wait) {
+    gpuResultRead = gpuResultPending;
+    if (gpuResultPending) {
+        gpuResultPending = false;
+        foundPresentTime = gpuPresentTime;
+        LONG64 mapStart = CaptureMetrics::Now();
+        foundLocations[0].blob = MatchBlob();
+        HRESULT hr = gpuMatcher.ReadResult(context, foundLocations[0].x, foundLocations[0].y);
+        metrics.Record(MetricStage::MapWait, mapStart, CaptureMetrics::Now());
+        return hr;
+    }
+
+    return AnalyzeStagingCopy(wait);
+}
+
+// Copies every region into its column of the next staging atlas
+HRESULT DX11::SubmitStagingCopy() {
+    int count = static_cast<int>(stagingTextures.size());
+
+    // With every slot in flight the oldest copy has to be scanned before it can be reused. Its
+    // result is reported here, the next AnalyzeRegionCopy overwrites it with the following copy's.
+    if (stagingPending == count) {
+        HRESULT hr = AnalyzeStagingCopy(true);
+        if (FAILED(hr)) {
+            return hr;
+        }
+        if (!frameQueue) {
+            ReportFoundLocations();
+        }
+    }
+
+    if (atlasLayout->tileSize > 0) {
+        HRESULT hr = CopyCandidateTiles(stagingTextures[stagingWriteIndex], stagingTileBits[stagingWriteIndex]);
+        if (FAILED(hr)) {
+            return hr;
+        }
+    }
+    else {
+        for (size_t i = 0; i < atlasLayout->regions.size(); ++i) {
+            context->CopySubresourceRegion(stagingTextures[stagingWriteIndex], 0, atlasLayout->regions[i].atlasX, 0, 0,
+                desktopTexture, 0, &captureBoxes[i]);
+        }
+    }
+    stagingPresentTimes[stagingWriteIndex] = frameInfo.LastPresentTime.QuadPart;
+    PointerOverlay& pointer = stagingPointers[stagingWriteIndex];
+    pointer.shape = pointerMasked ? pointerShape : nullptr;
+    pointer.x = pointerPosition.x;
+    pointer.y = pointerPosition.y;
+    pointer.boxes = captureBoxes;
+    stagingWriteIndex = (stagingWriteIndex + 1) % count;
+    stagingPending++;
+    return S_OK;
+}
+
+// Coarse mode: flags the tiles of every region that hold a match on the GPU, waits for the
+// flags and copies only those tiles into texture. The copies need the flags and the desktop
+// texture both, so ReadTileScan's Map blocks until the flagging pass finishes while the
+// duplication frame is still acquired; that stall is what coarse mode trades for the smaller
+// copy and scan, and it's counted in the MapWait stage. A region with most of its tiles flagged is
+// copied whole, which is one copy instead of many. When the GPU can't flag tiles (e.g. too
+// many targets for the shader) every tile is flagged and copied.
+HRESULT DX11::CopyCandidateTiles(ID3D11Texture2D* texture, std::vector<UINT>& tileBits) {
+    const AtlasLayout& layout = *atlasLayout;
+
+    HRESULT hr = gpuMatcher.BeginTileScan(context);
+    for (size_t i = 0; i < layout.regions.size() && SUCCEEDED(hr); ++i) {
+        const AtlasRegion& region = layout.regions[i];
+        hr = gpuMatcher.SubmitTileScan(context, desktopTexture, captureBoxes[i].left, captureBoxes[i].top,
+            region.width, region.height, region.settings->table, layout.tileSize, region.firstTile);
+    }
+    if (SUCCEEDED(hr)) {
+        LONG64 mapStart = CaptureMetrics::Now();
+        hr = gpuMatcher.ReadTileScan(context, layout.tileCount, tileBits);
+        metrics.Record(MetricStage::MapWait, mapStart, CaptureMetrics::Now());
+    }
+    if (FAILED(hr)) {
+        if (IsDeviceLostError(hr)) {
+            return hr;
+        }
+        tileBits.assign((layout.tileCount + 31) / 32, 0xFFFFFFFF);
+    }
+
+    for (size_t i = 0; i < layout.regions.size(); ++i) {
+        const AtlasRegion& region = layout.regions[i];
+        const D3D11_BOX& box = captureBoxes[i];
+        int tilesPerRow = (region.width + layout.tileSize - 1) / layout.tileSize;
+        int tileRows = (region.height + layout.tileSize - 1) / layout.tileSize;
+        auto flagged = [&](int tile) {
+            tile += region.firstTile;
+            return ((tileBits[tile >> 5] >> (tile & 31)) & 1) != 0;
+        };
+
+        int flaggedCount = 0;
+        for (int tile = 0; tile < tilesPerRow * tileRows; ++tile) {
+            flaggedCount += flagged(tile) ? 1 : 0;
+        }
+        if (flaggedCount * 2 > tilesPerRow * tileRows) {
+            context->CopySubresourceRegion(texture, 0, region.atlasX, 0, 0, desktopTexture, 0, &box);
+            continue;
+        }
+
+        for (int tile = 0; tile < tilesPerRow * tileRows; ++tile) {
+            if (!flagged(tile)) {
+                continue;
+            }
+            UINT left = (tile % tilesPerRow) * layout.tileSize;
+            UINT top = (tile / tilesPerRow) * layout.tileSize;
+            D3D11_BOX tileBox = {
+                box.left + left,
+                box.top + top,
+                0,
+                box.left + min(static_cast<UINT>(region.width), left + layout.tileSize),
+                box.top + min(static_cast<UINT>(region.height), top + layout.tileSize),
+                1
+            };
+            context->CopySubresourceRegion(texture, 0, region.atlasX + left, top, 0, desktopTexture, 0, &tileBox);
         }
+    }
+    return S_OK;
+}
+
+// Maps and scans the oldest pending copy. Unless wait is set, a copy the GPU hasn't finished
+// yet is left in the ring (S_FALSE) while there is still a free slot for the next frame's
+// copy, instead of stalling on it. With a single slot this always waits.
+HRESULT DX11::AnalyzeStagingCopy(bool wait) {
+    if (stagingPending == 0) {
+        return S_OK;
+    }
+
+    int count = static_cast<int>(stagingTextures.size());
+    int slot = (stagingWriteIndex - stagingPending + count) % count;
+    ID3D11Texture2D* texture = stagingTextures[slot];
+    UINT mapFlags = (!wait && stagingPending < count) ? D3D11_MAP_FLAG_DO_NOT_WAIT : 0;
+
+    D3D11_MAPPED_SUBRESOURCE mappedResource;
+    LONG64 mapStart = CaptureMetrics::Now();
+    HRESULT hr = context->Map(texture, 0, D3D11_MAP_READ, mapFlags, &mappedResource);
+    if (hr == DXGI_ERROR_WAS_STILL_DRAWING) {
+        return S_FALSE;  // Keep reporting the previous result until this copy lands
+    }
+    if (FAILED(hr)) {
+        return hr;
+    }
+    LONG64 scanStart = CaptureMetrics::Now();
+    metrics.Record(MetricStage::MapWait, mapStart, scanStart);
+    stagingPending--;
 
-        context->Unmap(stagingTexture, 0);
+    const BYTE* data = static_cast<const BYTE*>(mappedResource.pData);
+    if (frameQueue) {
+        QueueFrameForAnalysis(data, mappedResource.RowPitch, stagingPresentTimes[slot], stagingTileBits[slot],
+            stagingPointers[slot]);
+    }
+    else {
+        foundPresentTime = stagingPresentTimes[slot];
+
+        // The mapped copy is read-only, so the pointer is painted over a converted copy as well
+        const PointerOverlay& pointer = stagingPointers[slot];
+        UINT pitch = mappedResource.RowPitch;
+        if (atlasLayout->format != DXGI_FORMAT_B8G8R8A8_UNORM || pointer.shape) {
+            pitch = atlasLayout->width * 4;
+            convertedAtlas.resize(static_cast<size_t>(pitch) * atlasLayout->height);
+            for (UINT y = 0; y < atlasLayout->height; ++y) {
+                ConvertRowToBgra8(atlasLayout->format, data + y * mappedResource.RowPitch, atlasLayout->width,
+                    convertedAtlas.data() + y * pitch);
+            }
+            if (pointer.shape) {
+                MaskPointer(*atlasLayout, pointer, convertedAtlas.data(), pitch);
+            }
+            data = convertedAtlas.data();
+        }
 
-        if (!matchingPixels.empty()) {
-            if (findClosest) {
-                // Find the pixel closest to the center
-                foundLocation = *std::min_element(matchingPixels.begin(), matchingPixels.end(),
-                    [centerX, centerY](const PixelLocation& a, const PixelLocation& b) {
-                        int distA = (a.x - centerX) * (a.x - centerX) + (a.y - centerY) * (a.y - centerY);
-                        int distB = (b.x - centerX) * (b.x - centerX) + (b.y - centerY) * (b.y - centerY);
-                        return distA < distB;
-                    });
-            } else {
-                // We've already found the highest pixel and returned, but just in case:
-                foundLocation = matchingPixels[0];
+        for (size_t i = 0; i < atlasLayout->regions.size(); ++i) {
+            PixelLocation& found = foundLocations[i];
+            if (!ScanAtlasRegion(*atlasLayout, i, data, pitch, stagingTileBits[slot], trackingStates[i], matchMask,
+                matchBlobs, found.x, found.y, found.blob)) {
+                found = {-1, -1};  // Reset found location if no match
             }
-            return S_OK;  // Found at least one matching color
+        }
+        metrics.Record(MetricStage::Scan, scanStart, CaptureMetrics::Now());
+        if (recordQueue) {
+            QueueFrameForRecording(atlasLayout, data, pitch, foundPresentTime, foundLocations, GetDesktopOrigin());
         }
     }
 
-    foundLocation = {-1, -1};  // Reset found location if no match
-    return hr;
+    context->Unmap(texture, 0);
+    return S_OK;
 }
 
-void DX11::CleanUp() {
+// Copies the mapped atlas, converted to BGRA8 and with the pointer masked, into the next free
+// queue slot. When the analysis thread has fallen behind the frame is dropped rather than making
+// the capture thread wait.
+void DX11::QueueFrameForAnalysis(const BYTE* data, UINT rowPitch, LONG64 presentTime, const std::vector<UINT>& tileBits,
+    const PointerOverlay& pointer) {
+    PendingFrame* frame = frameQueue->BeginPush();
+    if (!frame) {
+        droppedFrameCount++;
+        metrics.Add(&MetricsBlock::framesDropped, 1);
+        return;
+    }
+
+    UINT rowBytes = atlasLayout->width * 4;
+    frame->pixels.resize(static_cast<size_t>(rowBytes) * atlasLayout->height);
+    for (UINT y = 0; y < atlasLayout->height; ++y) {
+        ConvertRowToBgra8(atlasLayout->format, data + y * rowPitch, atlasLayout->width, frame->pixels.data() + y * rowBytes);
+    }
+    if (pointer.shape) {
+        MaskPointer(*atlasLayout, pointer, frame->pixels.data(), rowBytes);
+    }
+    frame->pitch = rowBytes;
+    frame->presentTime = presentTime;
+    frame->layout = atlasLayout;
+    frame->tileBits = tileBits;
+    frame->desktopOrigin = GetDesktopOrigin();
+
+    frameQueue->EndPush();
+    SetEvent(frameQueuedEvent);
+}
+
+void DX11::AnalysisWorker() {
+    std::vector<BYTE> mask;
+    std::vector<MatchBlob> blobs;
+    // Tracking starts over whenever the layout changes
+    std::shared_ptr<const AtlasLayout> trackedLayout;
+    std::vector<TrackingState> tracking;
+    std::vector<PixelLocation> locations;
+
+    while (!analysisExit) {
+        PendingFrame* frame = frameQueue->BeginPop();
+        if (!frame) {
+            WaitForSingleObject(frameQueuedEvent, 100);
+            continue;
+        }
+
+        if (frame->layout != trackedLayout) {
+            trackedLayout = frame->layout;
+            tracking.assign(trackedLayout->regions.size(), TrackingState());
+        }
+
+        LONG64 scanStart = CaptureMetrics::Now();
+        locations.assign(frame->layout->regions.size(), PixelLocation({ -1, -1 }));
+        for (size_t i = 0; i < frame->layout->regions.size(); ++i) {
+            const AtlasRegion& region = frame->layout->regions[i];
+            PixelLocation& location = locations[i];
+            if (ScanAtlasRegion(*frame->layout, i, frame->pixels.data(), frame->pitch, frame->tileBits, tracking[i], mask,
+                blobs, location.x, location.y, location.blob)) {
+                ReportMatch(region, location, frame->presentTime, frame->desktopOrigin);
+            }
+            else {
+                location = { -1, -1 };
+            }
+        }
+        LONG64 scanEnd = CaptureMetrics::Now();
+        metrics.Record(MetricStage::Scan, scanStart, scanEnd);
+        workerScanTicks = scanEnd - scanStart;
+        if (recordQueue) {
+            QueueFrameForRecording(frame->layout, frame->pixels.data(), frame->pitch, frame->presentTime, locations,
+                frame->desktopOrigin);
+        }
+
+        frameQueue->EndPop();
+    }
+}
+
+// Reports the matches in foundLocations from the capture thread
+void DX11::ReportFoundLocations() {
+    for (size_t i = 0; i < foundLocations.size(); ++i) {
+        if (foundLocations[i].x != -1 && foundLocations[i].y != -1) {
+            ReportMatch(atlasLayout->regions[i], foundLocations[i], foundPresentTime, GetDesktopOrigin());
+        }
+    }
+    // Frames that repeat this result aren't new detections for the end-to-end time
+    foundPresentTime = 0;
+}
+
+// Only for the capture thread, which is the one that updates outputDesc
+POINT DX11::GetDesktopOrigin() const {
+    POINT origin = { outputDesc.DesktopCoordinates.left, outputDesc.DesktopCoordinates.top };
+    return origin;
+}
+
+// Publishes the match in desktop coordinates, which only differ from output coordinates on
+// secondary outputs. Nothing here blocks: console output happens on ResultLogWorker.
+// desktopOrigin is the output's position when the frame was captured; the analysis thread can't
+// read outputDesc, which the capture thread rewrites when the duplication is recreated.
+void DX11::ReportMatch(const AtlasRegion& region, const PixelLocation& location, LONG64 presentTime, POINT desktopOrigin) {
+    LONG64 now = CaptureMetrics::Now();
+
+    // LastPresentTime is a QPC value, so it can be compared with CaptureMetrics::Now directly.
+    // It is 0 for frames where only the pointer moved.
+    if (presentTime > 0) {
+        metrics.Record(MetricStage::EndToEnd, presentTime, now);
+    }
+    metrics.Add(&MetricsBlock::matches, 1);
+
+    int offsetX = region.originX + desktopOrigin.x;
+    int offsetY = region.originY + desktopOrigin.y;
+    MatchBlob blob = location.blob;
+    blob.left += offsetX;
+    blob.right += offsetX;
+    blob.top += offsetY;
+    blob.bottom += offsetY;
+    results.Publish(region.resultSlot, region.name, location.x + offsetX, location.y + offsetY, blob, presentTime, now);
+}
+
+// Hands a scanned BGRA atlas to RecordWorker. Only copies: the encoding and the writes to the
+// mapped file happen there, and frames are dropped rather than waited for when it falls behind.
+void DX11::QueueFrameForRecording(const std::shared_ptr<const AtlasLayout>& layout, const BYTE* data, UINT pitch,
+    LONG64 presentTime, const std::vector<PixelLocation>& locations, POINT desktopOrigin) {
+    if (recordMatchesOnly && std::none_of(locations.begin(), locations.end(),
+        [](const PixelLocation& location) { return location.x != -1; })) {
+        return;
+    }
+
+    PendingRecord* record = recordQueue->BeginPush();
+    if (!record) {
+        droppedRecordCount++;
+        return;
+    }
+
+    UINT rowBytes = layout->width * 4;
+    record->pixels.resize(static_cast<size_t>(rowBytes) * layout->height);
+    for (UINT y = 0; y < layout->height; ++y) {
+        memcpy(record->pixels.data() + y * rowBytes, data + y * pitch, rowBytes);
+    }
+    record->presentTime = presentTime;
+    record->captureTime = CaptureMetrics::Now();
+    record->layout = layout;
+    record->locations = locations;
+    record->desktopLeft = desktopOrigin.x;
+    record->desktopTop = desktopOrigin.y;
+
+    recordQueue->EndPush();
+    SetEvent(recordQueuedEvent);
+}
+
+void DX11::RecordWorker() {
+    // A key record every so often, so a ring that lost the start of a delta chain can still be
+    // decoded from the next key onwards
+    const int KEY_INTERVAL = 30;
+    // Deltas go against the previous record of the same region, which readers find by name
+    std::vector<std::vector<UINT>> previous(MAX_RESULT_SLOTS);
+    std::vector<std::string> previousName(MAX_RESULT_SLOTS);
+    std::vector<int> sinceKey(MAX_RESULT_SLOTS, 0);
+    std::vector<UINT> pixels;
+    std::vector<BYTE> payload;
+
+    for (;;) {
+        PendingRecord* record = recordQueue->BeginPop();
+        if (!record) {
+            if (recordExit) {
+                break;
+            }
+            WaitForSingleObject(recordQueuedEvent, 100);
+            continue;
+        }
+
+        const AtlasLayout& layout = *record->layout;
+        UINT rowBytes = layout.width * 4;
+        for (size_t i = 0; i < layout.regions.size(); ++i) {
+            const AtlasRegion& region = layout.regions[i];
+            int slot = region.resultSlot;
+            pixels.resize(static_cast<size_t>(region.width) * region.height);
+            for (int y = 0; y < region.height; ++y) {
+                memcpy(&pixels[static_cast<size_t>(y) * region.width], record->pixels.data() + y * rowBytes + region.atlasX * 4,
+                    region.width * 4);
+            }
+
+            RecordHeader header = {};
+            header.presentTime = record->presentTime;
+            header.captureTime = record->captureTime;
+            header.desktopX = region.originX + record->desktopLeft;
+            header.desktopY = region.originY + record->desktopTop;
+            header.width = region.width;
+            header.height = region.height;
+            header.matchX = record->locations[i].x;
+            header.matchY = record->locations[i].y;
+            size_t length = min(region.name.size(), sizeof(header.region) - 1);
+            memcpy(header.region, region.name.data(), length);
+
+            bool delta = slot < MAX_RESULT_SLOTS && previous[slot].size() == pixels.size() && previousName[slot] == region.name &&
+                sinceKey[slot] < KEY_INTERVAL;
+            if (recordCompression) {
+                header.encoding = EncodeRecordPixels(pixels.data(), delta ? previous[slot].data() : nullptr, pixels.size(), payload);
+            }
+            else {
+                header.encoding = RecordEncoding::Raw;
+                payload.resize(pixels.size() * sizeof(UINT));
+                memcpy(payload.data(), pixels.data(), payload.size());
+            }
+            header.payloadSize = static_cast<UINT32>(payload.size());
+            bool appended = recorder.Append(header, payload.data());
+
+            if (!appended && slot < MAX_RESULT_SLOTS) {
+                previous[slot].clear();  // Readers don't have it to apply the next delta to
+            }
+            else if (slot < MAX_RESULT_SLOTS) {
+                sinceKey[slot] = header.encoding == RecordEncoding::DeltaRle ? sinceKey[slot] + 1 : 0;
+                previous[slot].swap(pixels);
+                previousName[slot] = region.name;
+            }
+        }
+
+        recordQueue->EndPop();
+    }
+}
+
+// Prints the latest match of every region at most once per log interval, so a busy screen
+// costs a handful of console writes per second instead of one per match
+void DX11::ResultLogWorker(DWORD intervalMs) {
+    std::vector<LONG64> printed(MAX_RESULT_SLOTS, 0);
+    std::ostringstream lines;
+
+    while (WaitForSingleObject(logExitEvent, intervalMs) == WAIT_TIMEOUT) {
+        int regionCount = results.GetRegionCount();
+        for (int slot = 0; slot < regionCount; ++slot) {
+            ResultSlot result;
+            results.Read(slot, result);
+            if (result.sequence == printed[slot]) {
+                continue;
+            }
+            LONG64 updates = (result.sequence - printed[slot]) / 2;
+            printed[slot] = result.sequence;
+
+            if (!name.empty()) {
+                lines << "[" << name << "] ";
+            }
+            lines << "Found matching color ";
+            if (result.region[0]) {
+                lines << "in " << result.region << " ";
+            }
+            lines << "at: (" << result.x << ", " << result.y << ")";
+            if (result.blobArea > 0) {
+                lines << " blob of " << result.blobArea << " px (" << result.blobLeft << ", " << result.blobTop
+                    << ")-(" << result.blobRight << ", " << result.blobBottom << ")";
+            }
+            if (updates > 1) {
+                lines << " (" << updates << " matches)";
+            }
+            lines << "\n";
+        }
+
+        if (lines.tellp() > 0) {
+            // One write per interval; built up front so lines from several captures don't interleave
+            std::cout << lines.str() << std::flush;
+            lines.str(std::string());
+        }
+    }
+}
+
+// Releases everything created from the device, but not the device itself
+void DX11::ReleaseDeviceResources() {
+    gpuMatcher.CleanUp();
+    gpuResultPending = false;
     if (desktopTexture) desktopTexture->Release();
     if (desktopResource) desktopResource->Release();
-    if (stagingTexture) stagingTexture->Release();
+    desktopTexture = nullptr;
+    desktopResource = nullptr;
+    ReleaseStagingTextures();
+    ReleaseSharedTexture();
     if (desktopDupl) desktopDupl->Release();
+    if (duplicatedOutput) duplicatedOutput->Release();
+    desktopDupl = nullptr;
+    duplicatedOutput = nullptr;
+    hasAnalysis = false;
+}
+
+void DX11::CleanUp() {
+    ReleaseDeviceResources();
     if (context) context->Release();
     if (device) device->Release();
+    context = nullptr;
+    device = nullptr;
 }
 
-int main() {
-    DX11 dx11;
-    if (SUCCEEDED(dx11.Initialize())) {
-        dx11.CaptureAndAnalyze();
+int main(int argc, char* argv[]) {
+    // Output coordinates and window client areas in the same physical pixels on every monitor
+    SetProcessDpiAwarenessContext(DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE_V2);
+
+    CaptureConfig config;
+    std::string configPath;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--gpu") == 0) {
+            config.useGpuMatcher = true;
+        }
+        else if (strcmp(argv[i], "--lut") == 0) {
+            config.useLutMatcher = true;
+        }
+        else if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+            configPath = argv[++i];
+            if (!LoadCaptureConfig(configPath, config)) {
+                return 1;
+            }
+        }
+    }
+
+    std::vector<OutputSelection> selections = config.outputs;
+    if (config.captureAllOutputs) {
+        selections.clear();
+        for (const auto& output : EnumerateDesktopOutputs()) {
+            selections.push_back(output.selection);
+        }
+    }
+    if (selections.empty()) {
+        selections.push_back({ 0, 0 });
+    }
+
+    // One capture per output, each with its own device and duplication
+    std::vector<std::unique_ptr<DX11>> captures;
+    for (const auto& selection : selections) {
+        std::unique_ptr<DX11> capture(new DX11());
+        capture->SetConfig(config);
+        if (!configPath.empty()) {
+            capture->WatchConfigFile(configPath);
+        }
+        if (selections.size() > 1) {
+            capture->SetName(std::to_string(selection.adapter) + ":" + std::to_string(selection.output));
+        }
+        if (SUCCEEDED(capture->Initialize(selection.adapter, selection.output))) {
+            captures.push_back(std::move(capture));
+        }
+    }
+
+    if (captures.size() == 1) {
+        captures[0]->CaptureAndAnalyze();
+        return 0;
+    }
+
+    std::vector<std::thread> threads;
+    for (auto& capture : captures) {
+        threads.emplace_back(&DX11::CaptureAndAnalyze, capture.get());
+    }
+    for (auto& thread : threads) {
+        thread.join();
     }
     return 0;
-}
\ No newline at end of file
+}